@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+# krk_bench_engine.sh - compare the libevent and io_uring io engines
+#
+# Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# runs krake once per io_engine on the same configuration: <nodes>
+# nodes of one <checker> monitor on 127.0.x.y, all served by
+# krk_bench_target on a local port. the daemon runs under the
+# krk_bench_syscount preload, which counts the probes (stream
+# sockets) and the syscalls made by krake and libevent.
+#
+# run as root from the build directory of src/bench after
+# "make bench", with no other krake running:
+#
+#   sh krk_bench_engine.sh [nodes] [seconds] [checker] [interval] [timeout]
+#
+# KRAKE, KRK_BENCH_PORT and KRK_BENCH_WORKERS override the daemon
+# binary, the target port and the number of worker loops.
+
+NODES=${1:-1000}
+SECONDS_RUN=${2:-10}
+CHECKER=${3:-http}
+INTERVAL=${4:-100ms}
+TIMEOUT=${5:-50ms}
+
+KRAKE=${KRAKE:-../daemon/krake}
+PORT=${KRK_BENCH_PORT:-8099}
+WORKERS=${KRK_BENCH_WORKERS:-0}
+PID_FILE=/var/run/krake.pid
+SOCK_FILE=/var/run/krake.sock
+TMP=${TMPDIR:-/tmp}/krk_bench_engine.$$
+
+die()
+{
+    echo "$0: $*" >&2
+    exit 1
+}
+
+# krake writes its pid as a binary int
+read_pid()
+{
+    od -An -t d4 -N4 $PID_FILE | tr -d ' '
+}
+
+[ -x "$KRAKE" ] || die "no krake at $KRAKE, set KRAKE"
+[ -x ./krk_bench_target ] || die "no ./krk_bench_target, run make bench"
+[ -f ./krk_bench_syscount.so ] || die "no ./krk_bench_syscount.so, run make bench"
+[ "$NODES" -ge 1 ] && [ "$NODES" -le 10000 ] || die "nodes must be 1..10000"
+
+case "$CHECKER" in
+    tcp|http) ;;
+    *) die "checker must be tcp or http" ;;
+esac
+
+if [ -f $PID_FILE ] && kill -0 "$(read_pid)" 2>/dev/null; then
+    die "krake is running, stop it first"
+fi
+
+mkdir -p "$TMP" || die "cannot create $TMP"
+
+./krk_bench_target "$PORT" &
+TARGET=$!
+trap 'kill $TARGET 2>/dev/null; rm -rf "$TMP"' EXIT
+sleep 0.2
+kill -0 $TARGET 2>/dev/null || die "krk_bench_target did not start"
+
+# $1: io engine
+write_conf()
+{
+    echo '<?xml version="1.0"?>'
+    echo '<krk_config>'
+    echo "<global><io_engine>$1</io_engine><workers>$WORKERS</workers></global>"
+    echo '<monitor>'
+    echo '    <name>bench</name>'
+    echo '    <status>enable</status>'
+    echo "    <checker>$CHECKER</checker>"
+    echo "    <interval>$INTERVAL</interval>"
+    echo "    <timeout>$TIMEOUT</timeout>"
+    echo '    <failure_threshold>2</failure_threshold>'
+    echo '    <success_threshold>1</success_threshold>'
+    i=0
+    while [ $i -lt "$NODES" ]; do
+        echo "    <node><host>127.0.$((i / 250)).$((i % 250 + 1))</host><port>$PORT</port></node>"
+        i=$((i + 1))
+    done
+    echo '</monitor>'
+    echo '<log><logtype>file</logtype><loglevel>err</loglevel></log>'
+    echo '</krk_config>'
+}
+
+# $1: io engine
+run_engine()
+{
+    conf=$TMP/$1.conf
+    count=$TMP/$1.count
+
+    write_conf "$1" > "$conf"
+    rm -f $PID_FILE $SOCK_FILE "$count"
+
+    start=$(date +%s.%N)
+    KRK_BENCH_SYSCOUNT=$count LD_PRELOAD=$PWD/krk_bench_syscount.so \
+        "$KRAKE" -c "$conf" || die "krake -c failed with $1"
+    sleep 0.5
+    [ -f $PID_FILE ] || die "krake did not start with $1, see /tmp/krake.log"
+    pid=$(read_pid)
+
+    sleep "$SECONDS_RUN"
+    end=$(date +%s.%N)
+    up=$("$KRAKE" -s bench 2>&1 | grep -c "^down = 0")
+    "$KRAKE" -q
+
+    while kill -0 "$pid" 2>/dev/null; do
+        sleep 0.1
+    done
+
+    # the daemon is the process that opened the probe sockets,
+    # the rate is over the run, the quit opens none
+    sort -k4,4n "$count" | tail -1 | awk -v engine="$1" \
+        -v secs="$(echo "$end - $start" | awk '{ print $1 - $3 }')" \
+        -v up="$up" '{
+        printf "%-9s %8d %10d %10.1f %12d %10.2f\n",
+            engine, up, $4, $4 / secs, $6, $4 ? $6 / $4 : 0
+        detail = ""
+        for (i = 7; i < NF; i += 2) {
+            detail = detail sprintf(" %s=%.2f", $i, $4 ? $(i + 1) / $4 : 0)
+        }
+        print "          per probe:" detail
+    }'
+}
+
+echo "checker = $CHECKER, nodes = $NODES, interval = $INTERVAL," \
+     "timeout = $TIMEOUT, workers = $WORKERS, $SECONDS_RUN s per engine"
+printf "%-9s %8s %10s %10s %12s %10s\n" \
+    engine up probes probes/s syscalls syscalls/probe
+
+run_engine libevent
+run_engine io_uring
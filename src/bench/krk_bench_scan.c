@@ -0,0 +1,184 @@
+/**
+ * krk_bench_scan.c - Krake node scan benchmark
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <config.h>
+
+#include <krk_core.h>
+#include <krk_monitor.h>
+
+/**
+ * a pass over all the nodes counting the due, the down and
+ * the suspect ones, as a scheduler tick over the nodes would.
+ *
+ * before: the hot state lives inside each struct krk_node, the
+ * nodes are allocated one by one with their checker data and
+ * response buffer in between, and reached through the list.
+ *
+ * after: the hot state lives in the dense array of
+ * struct krk_node_state, the nodes are not touched.
+ *
+ * usage: krk_bench_scan [nodes] [rounds]
+ */
+
+#define KRK_BENCH_NODES 100000
+#define KRK_BENCH_ROUNDS 20
+/* what http_init_node allocates beside a node */
+#define KRK_BENCH_CHECKER_DATA 256
+#define KRK_BENCH_NODE_BUF 4096
+
+struct krk_bench_node {
+    struct krk_node node;
+    struct krk_node_state state;
+};
+
+struct krk_bench_count {
+    unsigned int nr_due;
+    unsigned int nr_down;
+    unsigned int nr_suspect;
+};
+
+static unsigned long long krk_bench_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static inline void krk_bench_count_state(struct krk_node_state *state,
+        unsigned long long now, struct krk_bench_count *count)
+{
+    count->nr_due += (state->deadline <= now);
+    count->nr_down += state->down;
+    count->nr_suspect += state->down ?
+        (state->nr_success != 0) : (state->nr_fail != 0);
+}
+
+static void krk_bench_init_state(struct krk_node_state *state, unsigned int i)
+{
+    state->used = 1;
+    state->deadline = (i % 7) * 1000;
+    state->down = (i % 5 == 0);
+    state->nr_fail = i % 3;
+    state->nr_success = i % 2;
+}
+
+static void krk_bench_list_walk(struct list_head *nodes,
+        unsigned long long now, struct krk_bench_count *count)
+{
+    struct list_head *p, *n;
+    struct krk_bench_node *bn;
+
+    list_for_each_safe(p, n, nodes) {
+        bn = list_entry(p, struct krk_bench_node, node.list);
+        krk_bench_count_state(&bn->state, now, count);
+    }
+}
+
+static void krk_bench_array_scan(struct krk_node_state *states,
+        unsigned int nr, unsigned long long now, struct krk_bench_count *count)
+{
+    struct krk_node_state *state, *end = states + nr;
+
+    for (state = states; state < end; state++) {
+        if (!state->used) {
+            continue;
+        }
+
+        krk_bench_count_state(state, now, count);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct list_head nodes;
+    struct krk_bench_node *bn;
+    struct krk_node_state *states;
+    struct krk_bench_count before, after;
+    unsigned long long start, best_before = ~0ULL, best_after = ~0ULL, t;
+    unsigned int nr = KRK_BENCH_NODES, rounds = KRK_BENCH_ROUNDS, i;
+
+    if (argc > 1) {
+        nr = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        rounds = strtoul(argv[2], NULL, 10);
+    }
+
+    if (nr == 0 || rounds == 0) {
+        fprintf(stderr, "usage: %s [nodes] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    INIT_LIST_HEAD(&nodes);
+
+    for (i = 0; i < nr; i++) {
+        bn = malloc(sizeof(struct krk_bench_node));
+        if (bn == NULL
+                || malloc(KRK_BENCH_CHECKER_DATA) == NULL
+                || malloc(KRK_BENCH_NODE_BUF) == NULL) {
+            fprintf(stderr, "out of memory at node %u\n", i);
+            return 1;
+        }
+
+        memset(bn, 0, sizeof(struct krk_bench_node));
+        krk_bench_init_state(&bn->state, i);
+        list_add_tail(&bn->node.list, &nodes);
+    }
+
+    if (posix_memalign((void **)&states, KRK_NODE_STATE_CACHELINE,
+                nr * sizeof(struct krk_node_state))) {
+        fprintf(stderr, "out of memory for the state array\n");
+        return 1;
+    }
+
+    memset(states, 0, nr * sizeof(struct krk_node_state));
+    for (i = 0; i < nr; i++) {
+        krk_bench_init_state(&states[i], i);
+    }
+
+    for (i = 0; i < rounds; i++) {
+        memset(&before, 0, sizeof(before));
+        start = krk_bench_usec();
+        krk_bench_list_walk(&nodes, 3000, &before);
+        t = krk_bench_usec() - start;
+        if (t < best_before) {
+            best_before = t;
+        }
+
+        memset(&after, 0, sizeof(after));
+        start = krk_bench_usec();
+        krk_bench_array_scan(states, nr, 3000, &after);
+        t = krk_bench_usec() - start;
+        if (t < best_after) {
+            best_after = t;
+        }
+    }
+
+    if (before.nr_due != after.nr_due || before.nr_down != after.nr_down
+            || before.nr_suspect != after.nr_suspect) {
+        fprintf(stderr, "the two scans disagree\n");
+        return 1;
+    }
+
+    printf("nodes = %u, due = %u, down = %u, suspect = %u\n",
+            nr, after.nr_due, after.nr_down, after.nr_suspect);
+    printf("node size = %zu, state size = %zu\n",
+            sizeof(struct krk_bench_node), sizeof(struct krk_node_state));
+    printf("before, list walk:   %llu us, %.2f ns/node\n",
+            best_before, best_before * 1000.0 / nr);
+    printf("after, state array:  %llu us, %.2f ns/node\n",
+            best_after, best_after * 1000.0 / nr);
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+/**
+ * krk_bench_syscount.c - Krake syscall counter for the engine benchmark
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+/**
+ * LD_PRELOAD'ed into the daemon, counts the calls into the
+ * syscall wrappers of libc made by krake and libevent, and
+ * writes the counts to $KRK_BENCH_SYSCOUNT when the process
+ * exits. io_uring_enter goes through syscall(2), so it is
+ * counted as well, the ops it carries are not syscalls.
+ *
+ * calls libc makes to itself, such as the write of a stdio
+ * flush, do not go through the wrappers and are not counted.
+ *
+ * a probe is an AF_INET/AF_INET6 stream socket, tcp and http
+ * open one per probe with both engines.
+ */
+
+enum {
+    KRK_SC_SOCKET = 0,
+    KRK_SC_CONNECT,
+    KRK_SC_CLOSE,
+    KRK_SC_READ,
+    KRK_SC_WRITE,
+    KRK_SC_RECV,
+    KRK_SC_SEND,
+    KRK_SC_RECVFROM,
+    KRK_SC_SENDTO,
+    KRK_SC_RECVMSG,
+    KRK_SC_SENDMSG,
+    KRK_SC_READV,
+    KRK_SC_WRITEV,
+    KRK_SC_GETSOCKOPT,
+    KRK_SC_SETSOCKOPT,
+    KRK_SC_FCNTL,
+    KRK_SC_IOCTL,
+    KRK_SC_EPOLL_WAIT,
+    KRK_SC_EPOLL_PWAIT,
+    KRK_SC_EPOLL_CTL,
+    KRK_SC_POLL,
+    KRK_SC_IO_URING_ENTER,
+    KRK_SC_SYSCALL,
+    KRK_SC_MAX
+};
+
+static const char *krk_sc_names[KRK_SC_MAX] = {
+    "socket",
+    "connect",
+    "close",
+    "read",
+    "write",
+    "recv",
+    "send",
+    "recvfrom",
+    "sendto",
+    "recvmsg",
+    "sendmsg",
+    "readv",
+    "writev",
+    "getsockopt",
+    "setsockopt",
+    "fcntl",
+    "ioctl",
+    "epoll_wait",
+    "epoll_pwait",
+    "epoll_ctl",
+    "poll",
+    "io_uring_enter",
+    "syscall"
+};
+
+static unsigned long krk_sc_count[KRK_SC_MAX];
+static unsigned long krk_sc_probes;
+
+#define krk_sc_inc(n) __sync_fetch_and_add(&krk_sc_count[n], 1)
+
+#define krk_sc_next(name) ({                                    \
+    static void *__f;                                           \
+    if (__f == NULL) {                                          \
+        __f = dlsym(RTLD_NEXT, #name);                          \
+    }                                                           \
+    (__typeof__(&name))__f;                                     \
+})
+
+static void __attribute__((destructor)) krk_sc_dump(void)
+{
+    unsigned long total = 0;
+    char *path;
+    FILE *fp;
+    int i;
+
+    path = getenv("KRK_BENCH_SYSCOUNT");
+    if (path == NULL) {
+        return;
+    }
+
+    fp = fopen(path, "a");
+    if (fp == NULL) {
+        return;
+    }
+
+    for (i = 0; i < KRK_SC_MAX; i++) {
+        total += krk_sc_count[i];
+    }
+
+    fprintf(fp, "pid %d probes %lu syscalls %lu",
+            (int)getpid(), krk_sc_probes, total);
+    for (i = 0; i < KRK_SC_MAX; i++) {
+        if (krk_sc_count[i]) {
+            fprintf(fp, " %s %lu", krk_sc_names[i], krk_sc_count[i]);
+        }
+    }
+    fprintf(fp, "\n");
+
+    fclose(fp);
+}
+
+int socket(int domain, int type, int protocol)
+{
+    krk_sc_inc(KRK_SC_SOCKET);
+
+    if ((domain == AF_INET || domain == AF_INET6)
+            && (type & 0xf) == SOCK_STREAM) {
+        __sync_fetch_and_add(&krk_sc_probes, 1);
+    }
+
+    return krk_sc_next(socket)(domain, type, protocol);
+}
+
+int connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+    krk_sc_inc(KRK_SC_CONNECT);
+    return krk_sc_next(connect)(fd, addr, len);
+}
+
+int close(int fd)
+{
+    krk_sc_inc(KRK_SC_CLOSE);
+    return krk_sc_next(close)(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    krk_sc_inc(KRK_SC_READ);
+    return krk_sc_next(read)(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    krk_sc_inc(KRK_SC_WRITE);
+    return krk_sc_next(write)(fd, buf, count);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+    krk_sc_inc(KRK_SC_RECV);
+    return krk_sc_next(recv)(fd, buf, len, flags);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    krk_sc_inc(KRK_SC_SEND);
+    return krk_sc_next(send)(fd, buf, len, flags);
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+        struct sockaddr *addr, socklen_t *addrlen)
+{
+    krk_sc_inc(KRK_SC_RECVFROM);
+    return krk_sc_next(recvfrom)(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+        const struct sockaddr *addr, socklen_t addrlen)
+{
+    krk_sc_inc(KRK_SC_SENDTO);
+    return krk_sc_next(sendto)(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+    krk_sc_inc(KRK_SC_RECVMSG);
+    return krk_sc_next(recvmsg)(fd, msg, flags);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    krk_sc_inc(KRK_SC_SENDMSG);
+    return krk_sc_next(sendmsg)(fd, msg, flags);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    krk_sc_inc(KRK_SC_READV);
+    return krk_sc_next(readv)(fd, iov, iovcnt);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    krk_sc_inc(KRK_SC_WRITEV);
+    return krk_sc_next(writev)(fd, iov, iovcnt);
+}
+
+int getsockopt(int fd, int level, int name, void *val, socklen_t *len)
+{
+    krk_sc_inc(KRK_SC_GETSOCKOPT);
+    return krk_sc_next(getsockopt)(fd, level, name, val, len);
+}
+
+int setsockopt(int fd, int level, int name, const void *val, socklen_t len)
+{
+    krk_sc_inc(KRK_SC_SETSOCKOPT);
+    return krk_sc_next(setsockopt)(fd, level, name, val, len);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+    va_list ap;
+    long arg;
+
+    va_start(ap, cmd);
+    arg = va_arg(ap, long);
+    va_end(ap);
+
+    krk_sc_inc(KRK_SC_FCNTL);
+    return krk_sc_next(fcntl)(fd, cmd, arg);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+    va_list ap;
+    void *arg;
+
+    va_start(ap, req);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    krk_sc_inc(KRK_SC_IOCTL);
+    return krk_sc_next(ioctl)(fd, req, arg);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int max, int timeout)
+{
+    krk_sc_inc(KRK_SC_EPOLL_WAIT);
+    return krk_sc_next(epoll_wait)(epfd, events, max, timeout);
+}
+
+int epoll_pwait(int epfd, struct epoll_event *events, int max, int timeout,
+        const sigset_t *sigmask)
+{
+    krk_sc_inc(KRK_SC_EPOLL_PWAIT);
+    return krk_sc_next(epoll_pwait)(epfd, events, max, timeout, sigmask);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    krk_sc_inc(KRK_SC_EPOLL_CTL);
+    return krk_sc_next(epoll_ctl)(epfd, op, fd, event);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    krk_sc_inc(KRK_SC_POLL);
+    return krk_sc_next(poll)(fds, nfds, timeout);
+}
+
+long syscall(long number, ...)
+{
+    va_list ap;
+    long a[6];
+    int i;
+
+    va_start(ap, number);
+    for (i = 0; i < 6; i++) {
+        a[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+
+#ifdef __NR_io_uring_enter
+    if (number == __NR_io_uring_enter) {
+        krk_sc_inc(KRK_SC_IO_URING_ENTER);
+    } else
+#endif
+    {
+        krk_sc_inc(KRK_SC_SYSCALL);
+    }
+
+    return krk_sc_next(syscall)(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
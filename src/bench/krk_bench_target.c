@@ -0,0 +1,160 @@
+/**
+ * krk_bench_target.c - Krake probe target for the engine benchmark
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <config.h>
+
+#include <krk_core.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * a local target for tcp and http probes: accepts on all the
+ * addresses of the port, answers the first read with a 200 and
+ * closes. a tcp probe just connects and closes, and is done
+ * with when the read sees the end of the stream.
+ *
+ * the nodes of the benchmark use 127.0.x.y, so one listener
+ * on INADDR_ANY serves them all.
+ *
+ * usage: krk_bench_target [port]
+ */
+
+#define KRK_BENCH_TARGET_PORT 8099
+#define KRK_BENCH_TARGET_EVENTS 256
+
+static const char krk_bench_response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 2\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "ok";
+
+static int krk_bench_listen(unsigned short port)
+{
+    struct sockaddr_in sin;
+    int fd, on = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0
+            || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void krk_bench_accept(int epfd, int lfd)
+{
+    struct epoll_event ev;
+    int fd;
+
+    for (;;) {
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+        }
+    }
+}
+
+static void krk_bench_serve(int fd)
+{
+    char buf[1024];
+    ssize_t n;
+
+    n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EAGAIN) {
+        return;
+    }
+
+    if (n > 0) {
+        /* a short reply to a fresh socket, it never blocks */
+        n = write(fd, krk_bench_response, sizeof(krk_bench_response) - 1);
+    }
+
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    struct epoll_event ev, events[KRK_BENCH_TARGET_EVENTS];
+    unsigned short port = KRK_BENCH_TARGET_PORT;
+    int epfd, lfd, n, i;
+
+    if (argc > 1) {
+        port = strtoul(argv[1], NULL, 10);
+    }
+
+    if (port == 0) {
+        fprintf(stderr, "usage: %s [port]\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    lfd = krk_bench_listen(port);
+    if (lfd < 0) {
+        fprintf(stderr, "listen on port %u failed: %s\n",
+                port, strerror(errno));
+        return 1;
+    }
+
+    epfd = epoll_create(1);
+    if (epfd < 0) {
+        fprintf(stderr, "epoll_create failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = lfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    for (;;) {
+        n = epoll_wait(epfd, events, KRK_BENCH_TARGET_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            return 1;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == lfd) {
+                krk_bench_accept(epfd, lfd);
+            } else {
+                krk_bench_serve(events[i].data.fd);
+            }
+        }
+    }
+
+    return 0;
+}
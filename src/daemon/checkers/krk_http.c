@@ -399,6 +399,7 @@ static void http_read_handler(int sock, short type, void *arg)
     struct krk_connection *conn;
     struct krk_node *node;
     struct krk_monitor *monitor;
+    struct krk_buffer *buf;
     int ret;
 
     krk_log(KRK_LOG_DEBUG, "read a http reply, type is %d\n", type);
@@ -417,6 +418,13 @@ static void http_read_handler(int sock, short type, void *arg)
 
     if (type == EV_READ) {
         ret = conn->recv(conn, node->buf->last, node->buf->end - node->buf->last);
+        if (ret < 0 && errno == EAGAIN) {
+            /* spurious wakeup or a partial tls record */
+            krk_connection_read_more(conn, node->buf->last, 
+                    node->buf->end - node->buf->last);
+            return;
+        }
+
         if (ret < 0) {
             krk_log(KRK_LOG_DEBUG, "read a http reply, failed: %d\n", ret);
             krk_monitor_node_failure_inc(monitor, node);
@@ -435,11 +443,13 @@ static void http_read_handler(int sock, short type, void *arg)
 
         if ((node->buf->last + ret) == node->buf->end) {
             /* buffer is full, double current size */
-            node->buf = krk_buffer_resize(node->buf, node->buf->size * 2);
-            if (!node->buf) {
-                krk_event_add(conn->rev);
-                return;
+            buf = krk_buffer_resize(node->buf, node->buf->size * 2);
+            if (buf == NULL) {
+                /* the old buffer is kept, the probe is over */
+                krk_monitor_node_failure_inc(monitor, node);
+                goto out;
             }
+            node->buf = buf;
         }
 
         node->buf->last += ret;
@@ -450,7 +460,8 @@ static void http_read_handler(int sock, short type, void *arg)
         ret = http_handle_response(node);
         if (ret == KRK_AGAIN) {
             /* header or body not completed */
-            krk_event_add(conn->rev);
+            krk_connection_read_more(conn, node->buf->last, 
+                    node->buf->end - node->buf->last);
             return;
         } 
 
@@ -471,7 +482,7 @@ static void http_read_handler(int sock, short type, void *arg)
             krk_monitor_node_failure_inc(monitor, node);
         }
     } else if (type == EV_TIMEOUT) {
-        krk_monitor_node_failure_inc(monitor, node);
+        krk_monitor_node_timeout_inc(monitor, node);
     }
 
 out:
@@ -497,53 +508,54 @@ static void http_write_handler(int sock, short type, void *arg)
     monitor = node->parent;
     hcp = monitor->parsed_checker_param;
 
-    if (type == EV_WRITE) {
+    if (type == EV_WRITE && conn->sending) {
+        /* back from io_uring, take the result of the send */
+        ret = conn->send(conn, NULL, 0);
+        if (ret < 0) {
+            krk_monitor_node_failure_inc(monitor, node);
+            goto failed;
+        }
+
+        krk_connection_wait_read(conn, node->buf->last, 
+                node->buf->end - node->buf->last);
+    } else if (type == EV_WRITE) {
         /* we've got a writable signal, send out the http packet */
-        packet = malloc(KRK_MAX_HTTP_SEND);
+        packet = krk_arena_calloc(&conn->arena, KRK_MAX_HTTP_SEND);
         if (packet == NULL) {
             goto failed;
         }
 
-        memset(packet, 0, KRK_MAX_HTTP_SEND);
-
         /* there is always a send-string, by default it's "GET / HTTP/1.1" */
         memcpy(packet, hcp->send, hcp->send_len);
 
         /* schedule read handler */
-        conn->rev->timeout = malloc(sizeof(struct timeval));
-        if (!conn->rev->timeout) {
-            goto failed;
-        }
-
-        conn->rev->timeout->tv_sec = monitor->timeout;
-        conn->rev->timeout->tv_usec = 0;
+        krk_event_set_timeout(conn->rev, monitor->timeout);
 
         ret = conn->send(conn, packet, hcp->send_len);
+        if (ret < 0 && conn->sending) {
+            /* queued to io_uring, back here once it is sent */
+            return;
+        }
+
         if (ret < 0) {
             krk_monitor_node_failure_inc(monitor, node);
             goto failed;
         }
 
-        krk_event_set_read(conn->sock, conn->rev);
-        krk_event_add(conn->rev);
+        krk_connection_wait_read(conn, node->buf->last, 
+                node->buf->end - node->buf->last);
     } else if (type == EV_TIMEOUT) {
         krk_log(KRK_LOG_INFO, "write timeout!\n");
         
-        krk_monitor_node_failure_inc(monitor, node);
+        krk_monitor_node_timeout_inc(monitor, node);
 
         goto failed;
     }
 
-out:
-    if (packet)
-        free(packet);
-
     return;
 
 failed:
     krk_monitor_node_cleanup(node, conn);
-
-    goto out;
 }
 
 static int http_init_node(struct krk_node *node)
@@ -552,17 +564,17 @@ static int http_init_node(struct krk_node *node)
 
     krk_log(KRK_LOG_DEBUG, "http init node, node: %s\n", node->addr);
     
-    node->ready = 1;
+    node->state->ready = 1;
 
     node->buf = krk_buffer_create(4096);
     if (!node->buf) {
-        node->ready = 0;
+        node->state->ready = 0;
         return KRK_ERROR;
     }
 
     hrh = malloc(sizeof(struct http_response_header));
     if (!hrh) {
-        node->ready = 0;
+        node->state->ready = 0;
         krk_buffer_destroy(node->buf);
         return KRK_ERROR;
     }
@@ -576,7 +588,7 @@ static int http_cleanup_node(struct krk_node *node)
 {
     krk_log(KRK_LOG_DEBUG, "http cleanup node, node: %s\n", node->addr);
     
-    node->ready = 0;
+    node->state->ready = 0;
 
     krk_buffer_destroy(node->buf);
 
@@ -609,8 +621,7 @@ static int http_init_ssl(struct krk_node *node, struct krk_connection *conn)
 
         conn->wev->data = node;
 
-        conn->wev->timeout->tv_sec = monitor->timeout;
-        conn->wev->timeout->tv_usec = 0;
+        krk_event_set_timeout(conn->wev, monitor->timeout);
         krk_event_set_write(conn->sock, conn->wev);
         krk_event_add(conn->wev);
 
@@ -622,8 +633,7 @@ static int http_init_ssl(struct krk_node *node, struct krk_connection *conn)
 
         conn->rev->data = node;
 
-        conn->rev->timeout->tv_sec = monitor->timeout;
-        conn->rev->timeout->tv_usec = 0;
+        krk_event_set_timeout(conn->rev, monitor->timeout);
         krk_event_set_read(conn->sock, conn->rev);
         krk_event_add(conn->rev);
 
@@ -654,7 +664,7 @@ static void http_check_ssl_handler(int sock, short type, void *arg)
     monitor = node->parent;
 
     if (type == EV_TIMEOUT) {
-        krk_monitor_node_failure_inc(monitor, node);
+        krk_monitor_node_timeout_inc(monitor, node);
         krk_monitor_node_cleanup(node, conn);
         
         return;
@@ -668,8 +678,7 @@ static void http_check_ssl_handler(int sock, short type, void *arg)
 
         conn->wev->data = node;
 
-        conn->wev->timeout->tv_sec = monitor->timeout;
-        conn->wev->timeout->tv_usec = 0;
+        krk_event_set_timeout(conn->wev, monitor->timeout);
         krk_event_set_write(conn->sock, conn->wev);
         krk_event_add(conn->wev);
     } else if (ret == KRK_AGAIN_READ) {
@@ -679,8 +688,7 @@ static void http_check_ssl_handler(int sock, short type, void *arg)
 
         conn->rev->data = node;
 
-        conn->rev->timeout->tv_sec = monitor->timeout;
-        conn->rev->timeout->tv_usec = 0;
+        krk_event_set_timeout(conn->rev, monitor->timeout);
         krk_event_set_read(conn->sock, conn->rev);
         krk_event_add(conn->rev);
     } else if (ret == KRK_OK) {
@@ -695,8 +703,7 @@ static void http_check_ssl_handler(int sock, short type, void *arg)
         conn->rev->data = node;
         conn->wev->data = node;
 
-        conn->wev->timeout->tv_sec = monitor->timeout;
-        conn->wev->timeout->tv_usec = 0;
+        krk_event_set_timeout(conn->wev, monitor->timeout);
         krk_event_set_write(conn->sock, conn->wev);
         krk_event_add(conn->wev);
     } else if (ret == KRK_ERROR) {
@@ -715,7 +722,6 @@ static void http_check_tcp_handler(int sock, short type, void *arg)
     struct krk_node *node;
     struct krk_monitor *monitor;
     int err, ret;
-    socklen_t errlen;
     
     wev = arg;
     node = wev->data;
@@ -723,22 +729,19 @@ static void http_check_tcp_handler(int sock, short type, void *arg)
     monitor = node->parent;
 
     if (type == EV_WRITE) {
-        errlen = sizeof(err);
-        ret = getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &err, &errlen);
-        if (ret == 0) {
-            if (err != 0) {
-                krk_log(KRK_LOG_DEBUG, "http: tcp connect failed(%d)!\n", errno);
-                
-                krk_monitor_node_failure_inc(monitor, node);
-                krk_monitor_node_cleanup(node, conn);
+        err = krk_connection_connect_error(conn);
+        if (err != 0) {
+            krk_log(KRK_LOG_DEBUG, "http: tcp connect failed(%d)!\n", err);
+            
+            krk_monitor_node_failure_inc(monitor, node);
+            krk_monitor_node_cleanup(node, conn);
 
-                return;
-            }
+            return;
         }
     } else if (type == EV_TIMEOUT) {
         krk_log(KRK_LOG_DEBUG, "http: tcp connect failed(time out)!\n");
         
-        krk_monitor_node_failure_inc(monitor, node);
+        krk_monitor_node_timeout_inc(monitor, node);
         krk_monitor_node_cleanup(node, conn);
 
         return;
@@ -769,11 +772,9 @@ static void http_check_tcp_handler(int sock, short type, void *arg)
     conn->rev->data = node;
     conn->wev->data = node;
 
-    conn->wev->timeout->tv_sec = monitor->timeout;
-    conn->wev->timeout->tv_usec = 0;
+    krk_event_set_timeout(conn->wev, monitor->timeout);
     
-    krk_event_set_write(conn->sock, conn->wev);
-    krk_event_add(conn->wev);
+    krk_connection_wait_write(conn);
 
     return;
 }
@@ -791,49 +792,41 @@ static int http_process_node(struct krk_node *node, void *param)
 
     sock = krk_socket_tcp_create(0);
     if (sock < 0) {
+        /* out of descriptors, not the node's fault */
+        if (errno == EMFILE || errno == ENFILE) {
+            return KRK_BUSY;
+        }
         return KRK_ERROR;
     }
 
     conn = krk_connection_create(node->addr, 0, 0);
     if (!conn) {
-        return KRK_ERROR;
+        krk_socket_close(sock);
+        return KRK_BUSY;
     }
 
     conn->sock = sock;
     monitor = node->parent;
 
-    ret = connect(conn->sock, (struct sockaddr*)&node->inaddr, 
+    conn->wev->handler = http_check_tcp_handler;
+
+    conn->rev->data = node;
+    conn->wev->data = node;
+
+    krk_event_set_timeout(conn->wev, monitor->timeout);
+
+    ret = krk_connection_connect(conn, (struct sockaddr*)&node->inaddr, 
             sizeof(struct sockaddr));
-    if (ret < 0 && errno != EINPROGRESS) {
+    if (ret == KRK_ERROR) {
         krk_connection_destroy(conn);
         krk_monitor_node_failure_inc(monitor, node);
         return KRK_ERROR;
     }
     
-    conn->wev->timeout = malloc(sizeof(struct timeval));
-    if (!conn->wev->timeout) {
-        krk_connection_destroy(conn);
-        return KRK_ERROR;
-    }
-
-    conn->rev->timeout = malloc(sizeof(struct timeval));
-    if (!conn->rev->timeout) {
-        krk_connection_destroy(conn);
-        return KRK_ERROR;
-    }
-
-    if (errno == EINPROGRESS) {
-        krk_log(KRK_LOG_DEBUG, "tcp connect returns INPROGRESS\n");
-        
-        conn->wev->handler = http_check_tcp_handler;
-
-        conn->rev->data = node;
-        conn->wev->data = node;
+    if (ret == KRK_AGAIN) {
+        krk_log(KRK_LOG_DEBUG, "tcp connect in progress\n");
 
-        conn->wev->timeout->tv_sec = monitor->timeout;
-        conn->wev->timeout->tv_usec = 0;
-        krk_event_set_write(conn->sock, conn->wev);
-        krk_event_add(conn->wev);
+        krk_monitor_add_node_connection(node, conn);
 
         return KRK_AGAIN;
     }
@@ -864,11 +857,9 @@ static int http_process_node(struct krk_node *node, void *param)
     conn->rev->data = node;
     conn->wev->data = node;
 
-    conn->wev->timeout->tv_sec = monitor->timeout;
-    conn->wev->timeout->tv_usec = 0;
+    krk_event_set_timeout(conn->wev, monitor->timeout);
     
-    krk_event_set_write(conn->sock, conn->wev);
-    krk_event_add(conn->wev);
+    krk_connection_wait_write(conn);
 
     return KRK_OK;
 }
@@ -10,12 +10,25 @@
  * (at your option) any later version.
  */
 
+/* sendmmsg and recvmmsg */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <config.h>
+
 #include <krk_core.h>
 #include <checkers/krk_checker.h>
 #include <checkers/krk_icmp.h>
 
+#include <stdio.h>
+#include <unistd.h>
 #include <netinet/ip.h>
+#include <netinet/icmp6.h>
 //#include <netinet/ip_icmp.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #include <krk_log.h>
 
@@ -24,6 +37,8 @@ static int icmp_parse_param(struct krk_monitor *monitor,
 static int icmp_init_node(struct krk_node *node);
 static int icmp_cleanup_node(struct krk_node *node);
 static int icmp_process_node(struct krk_node *node, void *param);
+static void icmp_read_handler(int sock, short type, void *arg);
+static void icmp_flush_handler(int sock, short type, void *arg);
 
 struct krk_checker icmp_checker = {
     "icmp",
@@ -34,338 +49,896 @@ struct krk_checker icmp_checker = {
     icmp_process_node,
 };
 
+#define KRK_ICMP_PACKET_LEN \
+    (KRK_MAX_IP_LEN + KRK_MAX_ICMP_LEN + KRK_ICMP_DATA_LEN)
+
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+#define icmp_mmsghdr mmsghdr
+#else
+/* same layout, the packets go one syscall each */
+struct icmp_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+/* an echo request waiting for the flush of its batch */
+struct icmp_echo {
+    unsigned char packet[KRK_ICMP_HDR_LEN + KRK_ICMP_DATA_LEN];
+    unsigned int handle;        /* of the node */
+    unsigned short sequence;    /* of the probe */
+    struct sockaddr_in6 to;     /* icmpv6 only */
+};
+
+/**
+ * the echo requests of a loop go out together, with one syscall,
+ * when the probes of the tick have been queued. replies are read 
+ * the same way into a ring of buffers. all of it is allocated with
+ * the socket and reused.
+ */
+struct icmp_batch {
+    struct krk_event *flush;    /* sends the batch after the tick */
+    unsigned int kicked:1;
+    unsigned int nr_echoes;
+    struct icmp_echo echoes[KRK_ICMP_SEND_BATCH];
+    struct icmp_mmsghdr out[KRK_ICMP_SEND_BATCH];
+    struct iovec out_iov[KRK_ICMP_SEND_BATCH];
+
+    unsigned char ring[KRK_ICMP_READ_BATCH][KRK_ICMP_PACKET_LEN];
+    struct sockaddr_in6 from[KRK_ICMP_READ_BATCH];  /* fits both */
+    struct icmp_mmsghdr in[KRK_ICMP_READ_BATCH];
+    struct iovec in_iov[KRK_ICMP_READ_BATCH];
+};
+
+/**
+ * one raw socket per event loop and address family, shared by 
+ * the icmp probes of the loop. the kernel copies each icmp packet
+ * to every raw icmp socket, with a socket per probe N probes in 
+ * flight meant N wakeups per reply.
+ *
+ * where ping_group_range allows, a ping socket is used instead.
+ * it needs no privilege, and the kernel only hands it the replies
+ * to its own requests.
+ */
+struct icmp_socket {
+    int sock;
+    unsigned int type;          /* KRK_ICMP_SOCKET_RAW or _DGRAM */
+    unsigned int ipv6;          /* icmpv6, no ip header on read */
+    struct krk_event *rev;
+    struct icmp_batch *batch;
+    unsigned int nr_nodes;      /* icmp nodes of the loop and family */
+};
+
+static struct icmp_socket icmp_sockets[KRK_EVENT_LOOP_MAX][2] = {
+    [0 ... KRK_EVENT_LOOP_MAX - 1] = { 
+        { .sock = -1 }, 
+        { .sock = -1, .ipv6 = 1 },
+    },
+};
+
+static unsigned int icmp_socket_type = KRK_ICMP_SOCKET_AUTO;
+
+/**
+ * icmp_ping_allowed - may ping sockets be opened
+ * @
+ *
+ * the kernel lets the groups in its ping_group_range open them,
+ * the range is empty by default on many systems.
+ *
+ * return 1 if allowed; 0 otherwise.
+ */
+static int icmp_ping_allowed(void)
+{
+    FILE *fp;
+    unsigned long low, high;
+    gid_t *groups;
+    int i, n, allowed = 0;
+
+    fp = fopen(KRK_ICMP_PING_GROUP_RANGE, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    n = fscanf(fp, "%lu %lu", &low, &high);
+    fclose(fp);
+    if (n != 2) {
+        return 0;
+    }
+
+    if (getegid() >= low && getegid() <= high) {
+        return 1;
+    }
+
+    n = getgroups(0, NULL);
+    if (n <= 0) {
+        return 0;
+    }
+
+    groups = malloc(n * sizeof(gid_t));
+    if (groups == NULL) {
+        return 0;
+    }
+
+    n = getgroups(n, groups);
+    for (i = 0; i < n; i++) {
+        if (groups[i] >= low && groups[i] <= high) {
+            allowed = 1;
+            break;
+        }
+    }
+
+    free(groups);
+
+    return allowed;
+}
+
+/**
+ * krk_icmp_set_socket_type - set the kind of icmp sockets to open
+ * @type: KRK_ICMP_SOCKET_*
+ *
+ * sockets already open keep theirs until their loop has no
+ * icmp node left.
+ */
+void krk_icmp_set_socket_type(unsigned int type)
+{
+    icmp_socket_type = type;
+
+    if (type == KRK_ICMP_SOCKET_DGRAM && !icmp_ping_allowed()) {
+        krk_log(KRK_LOG_ALERT, "icmp ping sockets are not allowed, "
+                "see %s\n", KRK_ICMP_PING_GROUP_RANGE);
+    }
+}
+
 static int icmp_parse_param(struct krk_monitor *monitor, 
         char *param, unsigned int param_len)
 {	
     return KRK_OK;
 }
 
-static int icmp_match_packet(void* packet, struct krk_node *node)
+static int icmp_match_packet(void* packet, int len, struct krk_node *node)
 {
-    struct krk_icmphdr *icp;
-    unsigned char monitor_id;
-    unsigned char node_id;
-    struct krk_monitor *monitor;
+    struct krk_icmp_payload *payload;
+    struct icmp_checker_data *icd;
+    unsigned int handle;
 
-    icp = packet;
-    node_id = icp->un.echo.id & 0xff;
-    monitor_id = (icp->un.echo.id >> 8) & 0xff;
+    if (len < KRK_ICMP_HDR_LEN + sizeof(struct krk_icmp_payload)) {
+        return 0;
+    }
 
-    monitor = node->parent;
+    payload = packet + KRK_ICMP_HDR_LEN;
+    handle = ntohl(payload->handle);
+    icd = node->checker_data;
 
-    krk_log(KRK_LOG_DEBUG, "m_id: %u, n_id: %u, m->id: %u, n->id: %u\n", 
-            monitor_id, node_id, monitor->id, node->id);
+    krk_log(KRK_LOG_DEBUG, "handle: %#x, seq: %u, n->id: %#x, n->seq: %u\n", 
+            handle, ntohs(payload->sequence), node->id, icd->sequence);
 
-    return ((monitor->id == monitor_id)
-            && (node->id == node_id)) ? 1 : 0;
+    /* a late reply to an earlier probe of the node does not count */
+    return ((node->id == handle)
+            && (ntohl(payload->magic) == KRK_ICMP_MAGIC)
+            && (ntohs(payload->sequence) == icd->sequence)) ? 1 : 0;
 }
 
-static void icmp_handle_same_addr_node(const struct krk_node *node)
+/**
+ * icmp_socket_filter - let only our echo replies through
+ * @sock: raw icmp socket
+ *
+ * a raw socket gets all the icmp of the host, the pings of other
+ * tools, unreachables and the like. the filter drops in the 
+ * kernel what is not an echo reply with our magic in the payload,
+ * it is never copied to us. without it, icmp_handle_reply sorts
+ * the packets out as well.
+ */
+static void icmp_socket_filter(int sock)
 {
-    struct krk_node nodes[256];
-    struct krk_monitor *monitor;
-    int n, i;
+#ifdef SO_ATTACH_FILTER
+    struct sock_filter code[] = {
+        /* x = length of the ip header */
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        /* icmp type */
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 3),
+        /* first word of the payload */
+        BPF_STMT(BPF_LD | BPF_W | BPF_IND, KRK_ICMP_HDR_LEN),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, KRK_ICMP_MAGIC, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = {
+        sizeof(code) / sizeof(code[0]),
+        code,
+    };
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, 
+                &prog, sizeof(prog)) < 0) {
+        krk_log(KRK_LOG_NOTICE, "icmp socket filter not attached: %s\n", 
+                strerror(errno));
+    }
+#endif
+}
 
-    n = krk_monitor_get_nodes_by_addr(node->addr, nodes);
-    for (i = 0; i < n; i++) {
-        if (nodes[i].id != node->id) {
-            monitor = nodes[i].parent;
-
-            if (node == &nodes[i]) {
-                continue;
-            }
-
-            if (!nodes[i].ready && 
-                    !strcmp("icmp", monitor->checker->name)) {
-                if (!nodes[i].down) {
-                    nodes[i].down = 1;
-                    krk_monitor_set_node_status(monitor, nodes[i].id, 1);
-                } else {
-                    nodes[i].down = 0;
-                    krk_monitor_set_node_status(monitor, nodes[i].id, 0);
-                }
-                krk_monitor_notify(monitor, &nodes[i]);
-            }
+/**
+ * icmp6_socket_filter - let only echo replies through
+ * @sock: raw icmpv6 socket
+ *
+ * the icmpv6 socket would get neighbor discovery and the like as
+ * well. the checksum of icmpv6 is always computed by the kernel,
+ * IPV6_CHECKSUM is refused on these sockets.
+ */
+static void icmp6_socket_filter(int sock)
+{
+#ifdef ICMP6_FILTER
+    struct icmp6_filter filter;
+
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+
+    if (setsockopt(sock, IPPROTO_ICMPV6, ICMP6_FILTER, 
+                &filter, sizeof(filter)) < 0) {
+        krk_log(KRK_LOG_NOTICE, "icmp6 socket filter not set: %s\n", 
+                strerror(errno));
+    }
+#endif
+}
+
+static void icmp_socket_put(struct icmp_socket *is);
+
+/**
+ * icmp_socket_open - open the socket of a loop
+ * @is: the loop's socket
+ *
+ * in auto mode a ping socket which cannot be opened falls back
+ * to a raw one.
+ *
+ * return the descriptor; -1 on error.
+ */
+static int icmp_socket_open(struct icmp_socket *is)
+{
+    unsigned int type = icmp_socket_type;
+
+    if (type == KRK_ICMP_SOCKET_AUTO) {
+        type = icmp_ping_allowed() ? 
+            KRK_ICMP_SOCKET_DGRAM : KRK_ICMP_SOCKET_RAW;
+    }
+
+    if (type == KRK_ICMP_SOCKET_DGRAM) {
+        if (is->ipv6) {
+            is->sock = krk_socket_dgram6_create(IPPROTO_ICMPV6);
+        } else {
+            is->sock = krk_socket_dgram_create(IPPROTO_ICMP);
         }
+
+        if (is->sock >= 0) {
+            /* the kernel filters by identifier, nothing to attach */
+            is->type = KRK_ICMP_SOCKET_DGRAM;
+            return is->sock;
+        }
+
+        if (icmp_socket_type == KRK_ICMP_SOCKET_DGRAM) {
+            krk_log(KRK_LOG_DEBUG, "icmp ping socket not opened: %s\n", 
+                    strerror(errno));
+            return -1;
+        }
+
+        krk_log(KRK_LOG_NOTICE, "icmp ping socket not opened: %s, "
+                "using a raw one\n", strerror(errno));
+    }
+
+    if (is->ipv6) {
+        is->sock = krk_socket_raw6_create(IPPROTO_ICMPV6);
+    } else {
+        is->sock = krk_socket_raw_create(IPPROTO_ICMP);
+    }
+
+    if (is->sock < 0) {
+        return -1;
+    }
+
+    is->type = KRK_ICMP_SOCKET_RAW;
+
+    if (is->ipv6) {
+        icmp6_socket_filter(is->sock);
+    } else {
+        icmp_socket_filter(is->sock);
     }
+
+    return is->sock;
 }
 
-static void icmp_read_handler(int sock, short type, void *arg)
+/**
+ * icmp_batch_create - allocate the batch of a loop's socket
+ * @is: the socket
+ *
+ * the receive side never changes, its headers are set up here 
+ * once.
+ *
+ * return the batch; NULL if out of memory.
+ */
+static struct icmp_batch* icmp_batch_create(struct icmp_socket *is)
+{
+    struct icmp_batch *batch;
+    struct msghdr *msg;
+    int i;
+
+    batch = malloc(sizeof(struct icmp_batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    memset(batch, 0, sizeof(struct icmp_batch));
+
+    batch->flush = krk_event_create(0);
+    if (batch->flush == NULL) {
+        free(batch);
+        return NULL;
+    }
+
+    batch->flush->handler = icmp_flush_handler;
+    batch->flush->data = is;
+    krk_event_set(-1, batch->flush, 0);
+    krk_event_add(batch->flush);
+
+    for (i = 0; i < KRK_ICMP_READ_BATCH; i++) {
+        batch->in_iov[i].iov_base = batch->ring[i];
+        batch->in_iov[i].iov_len = KRK_ICMP_PACKET_LEN;
+
+        msg = &batch->in[i].msg_hdr;
+        msg->msg_name = &batch->from[i];
+        msg->msg_iov = &batch->in_iov[i];
+        msg->msg_iovlen = 1;
+    }
+
+    return batch;
+}
+
+static void icmp_batch_destroy(struct icmp_batch *batch)
+{
+    krk_event_destroy(batch->flush);
+    free(batch);
+}
+
+/**
+ * icmp_socket_get - the raw socket of the current loop
+ * @ipv6: the icmpv6 one
+ *
+ * opened with the loop's first probe, its read event lives on 
+ * the loop.
+ *
+ * return the socket; NULL if it could not be opened.
+ */
+static struct icmp_socket* icmp_socket_get(unsigned int ipv6)
+{
+    struct icmp_socket *is;
+
+    is = &icmp_sockets[krk_current_loop->id][ipv6];
+    if (is->rev) {
+        return is;
+    }
+
+    if (icmp_socket_open(is) < 0) {
+        return NULL;
+    }
+
+    is->batch = icmp_batch_create(is);
+    if (is->batch == NULL) {
+        goto failed;
+    }
+
+    is->rev = krk_event_create(0);
+    if (is->rev == NULL) {
+        goto failed;
+    }
+
+    is->rev->handler = icmp_read_handler;
+    is->rev->data = is;
+
+    krk_event_set_persist_read(is->sock, is->rev);
+    krk_event_add(is->rev);
+
+    return is;
+
+failed:
+    icmp_socket_put(is);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static void icmp_socket_put(struct icmp_socket *is)
+{
+    if (is->rev) {
+        krk_event_destroy(is->rev);
+        is->rev = NULL;
+    }
+
+    /* echoes still queued go with it, their probes time out */
+    if (is->batch) {
+        icmp_batch_destroy(is->batch);
+        is->batch = NULL;
+    }
+
+    if (is->sock >= 0) {
+        krk_socket_close(is->sock);
+        is->sock = -1;
+    }
+}
+
+static void icmp_probe_done(struct krk_node *node)
+{
+    struct krk_connection *conn = node->conn;
+
+    krk_monitor_remove_node_connection(node, conn);
+    krk_connection_destroy(conn);
+}
+
+/**
+ * icmp_handle_reply - hand a packet read from the shared socket on
+ * @is: the socket
+ * @packet: ip packet, icmp packet for a ping or an icmpv6 socket
+ * @len: length of @packet
+ * @from: source of @packet
+ *
+ * the echo identifier and sequence carry the node handle, the
+ * node is looked up instead of searched for. the kernel copies 
+ * each icmp packet to the raw sockets of all the loops, a loop 
+ * only takes the replies to its own probes.
+ */
+static void icmp_handle_reply(struct icmp_socket *is, void *packet, int len,
+        struct sockaddr_in6 *from)
 {
-    struct krk_event *rev;
-    struct krk_connection *conn;
     struct krk_node *node;
     struct krk_monitor *monitor;
     struct krk_icmphdr *icp;
+    struct krk_icmp_payload *payload;
 #ifdef __BSD_VISIBLE
     struct ip *ip;
 #else
     struct iphdr *ip;
 #endif
-    struct icmp_checker_data *icd;
-    void *packet = NULL;
-    int ret, packlen;
-    socklen_t addrlen;
-
-    krk_log(KRK_LOG_DEBUG, "read a icmp reply, type is %d\n", type);
-    rev = arg;
-    node = rev->data;
-    conn = rev->conn;
+    unsigned int hlen, handle, saddr;
+    unsigned char reply;
+
+    if (is->ipv6) {
+        /* neither for raw icmpv6 sockets */
+        hlen = 0;
+        saddr = 0;
+    } else if (is->type == KRK_ICMP_SOCKET_RAW) {
+        ip = packet;
+#ifdef __BSD_VISIBLE
+        hlen = ip->ip_hl * 4;
+        saddr = ip->ip_src.s_addr;
+#else
+        hlen = ip->ihl * 4;
+        saddr = ip->saddr;
+#endif
+        if (hlen < 20) {
+            return;
+        }
+    } else {
+        /* no ip header, the source comes along */
+        hlen = 0;
+        saddr = ((struct sockaddr_in *)from)->sin_addr.s_addr;
+    }
+
+    if (len < hlen + KRK_ICMP_HDR_LEN + sizeof(struct krk_icmp_payload)) {
+        return;
+    }
+
+    /* we do not care about checksum */
+    icp = packet + hlen;
+    reply = is->ipv6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY;
+    if (icp->type != reply) {
+        return;
+    }
+
+    /* the kernel put its own identifier in for a ping socket */
+    if (is->type == KRK_ICMP_SOCKET_RAW) {
+        handle = krk_icmp_handle(icp);
+    } else {
+        payload = (void *)icp + KRK_ICMP_HDR_LEN;
+        handle = ntohl(payload->handle);
+    }
+
+    node = krk_monitor_find_node_by_handle(handle);
+    if (node == NULL 
+            || node->conn == NULL
+            || node->parent == NULL) {
+        return;
+    }
+
     monitor = node->parent;
-    icd = node->checker_data;
+    if (monitor->loop != krk_current_loop 
+            || monitor->checker != &icmp_checker) {
+        return;
+    }
 
-    if (type == EV_READ) {
-        packlen = KRK_MAX_IP_LEN + KRK_MAX_ICMP_LEN + KRK_ICMP_DATA_LEN;
-        packet = malloc(packlen);
-        if (packet == NULL) {
-            goto out;
+    if (is->ipv6) {
+        if (node->in6addr.sin6_family != AF_INET6
+                || memcmp(&from->sin6_addr, &node->in6addr.sin6_addr, 
+                    sizeof(struct in6_addr))) {
+            return;
         }
+    } else if (node->inaddr.sin_family != AF_INET
+            || saddr != node->inaddr.sin_addr.s_addr) {
+        return;
+    }
+
+    if (!icmp_match_packet(icp, len - hlen, node)) {
+        krk_log(KRK_LOG_DEBUG, "late icmp reply of %s\n", node->addr);
+        return;
+    }
+
+    krk_log(KRK_LOG_DEBUG, "got correct icmp reply\n");
+
+    krk_monitor_node_success_inc(monitor, node);
+
+    icmp_probe_done(node);
+}
+
+/**
+ * icmp_recv_batch - read the pending replies into the ring
+ * @sock: the loop's raw socket
+ * @batch: batch of the socket
+ *
+ * return the number of packets read, their lengths are in 
+ * batch->in; -1 if there was none.
+ */
+static int icmp_recv_batch(int sock, struct icmp_batch *batch)
+{
+    int i;
+#if !defined(HAVE_SENDMMSG) || !defined(HAVE_RECVMMSG)
+    int ret;
+#endif
 
-        addrlen = sizeof(struct sockaddr);
-        ret = recvfrom(sock, packet, packlen, 0, 
-                NULL, NULL);
+    for (i = 0; i < KRK_ICMP_READ_BATCH; i++) {
+        batch->in[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+    }
+
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+    return recvmmsg(sock, batch->in, KRK_ICMP_READ_BATCH, MSG_DONTWAIT, NULL);
+#else
+    for (i = 0; i < KRK_ICMP_READ_BATCH; i++) {
+        ret = recvmsg(sock, &batch->in[i].msg_hdr, MSG_DONTWAIT);
         if (ret < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                krk_event_add(conn->rev);
-                free(packet);
-                return;
-            }
+            break;
         }
 
-        /* recv ok */
-        ip = packet;
-#ifdef __BSD_VISIBLE
-        if (ip->ip_hl < 5) {
-#else
-        if (ip->ihl < 5) {
+        batch->in[i].msg_len = ret;
+    }
+
+    return i ? i : -1;
 #endif
-            goto out;
-        }
+}
 
-#ifdef __BSD_VISIBLE
-        krk_log(KRK_LOG_DEBUG, "saddr: %x\n", ip->ip_src.s_addr);
-        icp = packet + ip->ip_hl * 4;
+/**
+ * icmp_send_batch - send echo requests of the batch
+ * @sock: the loop's raw socket
+ * @batch: batch of the socket
+ * @from: first request to send
+ * @nr: number of requests from @from on
+ *
+ * return the number of requests sent, -1 if the first one 
+ * could not be.
+ */
+static int icmp_send_batch(int sock, struct icmp_batch *batch,
+        unsigned int from, unsigned int nr)
+{
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+    return sendmmsg(sock, &batch->out[from], nr, 0);
 #else
-        krk_log(KRK_LOG_DEBUG, "saddr: %x\n", ip->saddr);
-        icp = packet + ip->ihl * 4;
+    return sendmsg(sock, &batch->out[from].msg_hdr, 0) < 0 ? -1 : 1;
 #endif
-        /* we do not care about checksum */
-        krk_log(KRK_LOG_DEBUG, "ret is %d, icp->id is %x, node->id is %x\n", 
-                ret, icp->un.echo.id, node->id);
-
-        if (icp->type == ICMP_ECHOREPLY) {
-            if (icmp_match_packet(icp, node)) {
-                krk_log(KRK_LOG_DEBUG, "got correct icmp reply\n");
-                
-                krk_monitor_node_success_inc(monitor, node);
-                //icmp_handle_same_addr_node(node);
-            } else {
-                krk_log(KRK_LOG_DEBUG, "id not match\n");
-                free(packet);
-                krk_event_add(conn->rev);
-
-                return;
-            }
-        } else {
-            krk_log(KRK_LOG_DEBUG, "not match a icmp reply\n");
-            free(packet);
-            krk_event_add(conn->rev);
+}
 
-            return;
-        }
-    } else if (type == EV_TIMEOUT) {
-        krk_log(KRK_LOG_DEBUG, "icmp checker read timeout\n");
-        krk_monitor_node_failure_inc(monitor, node);
-        //icmp_handle_same_addr_node(node);
-    }
+static void icmp_read_handler(int sock, short type, void *arg)
+{
+    struct krk_event *rev = arg;
+    struct icmp_socket *is = rev->data;
+    int i, ret;
+
+    /* a bounded batch, the rest comes with the next wakeup */
+    ret = icmp_recv_batch(sock, is->batch);
 
-out:
-    if (packet) {
-        free(packet);
+    for (i = 0; i < ret; i++) {
+        icmp_handle_reply(is, is->batch->ring[i], 
+                is->batch->in[i].msg_len, &is->batch->from[i]);
     }
+}
 
-    krk_monitor_remove_node_connection(node, conn);
-    krk_connection_destroy(conn);
+static void icmp_timeout_handler(int sock, short type, void *arg)
+{
+    struct krk_event *rev = arg;
+    struct krk_node *node = rev->data;
+
+    krk_log(KRK_LOG_DEBUG, "icmp checker read timeout\n");
+
+    krk_monitor_node_timeout_inc(node->parent, node);
+
+    icmp_probe_done(node);
 }
 
-static void icmp_write_handler(int sock, short type, void *arg)
+static void icmp_error_handler(int sock, short type, void *arg)
+{
+    struct krk_event *rev = arg;
+    struct krk_node *node = rev->data;
+
+    krk_monitor_node_failure_inc(node->parent, node);
+
+    icmp_probe_done(node);
+}
+
+/**
+ * icmp_echo_failed - fail a probe whose request was refused
+ * @node: node of the probe
+ *
+ * a flush may run in the middle of processing another node, the
+ * failure is counted by the probe's timer on the next tick.
+ */
+static void icmp_echo_failed(struct krk_node *node)
+{
+    struct krk_event *rev = node->conn->rev;
+
+    rev->handler = icmp_error_handler;
+    krk_event_set_timeout(rev, 0);
+    krk_event_add(rev);
+}
+
+/**
+ * icmp_echo_node - the node a queued echo request is still for
+ * @echo: the request
+ *
+ * return the node; NULL if it went away or it is probed again
+ * meanwhile.
+ */
+static struct krk_node* icmp_echo_node(struct icmp_echo *echo)
 {
-    struct krk_event *wev;
-    struct krk_connection *conn;
     struct krk_node *node;
-    struct krk_monitor *monitor;
-    struct krk_icmphdr *icp;
     struct icmp_checker_data *icd;
-    void *packet = NULL;
-    int ret;
 
-    wev = arg;
-    node = wev->data;
-    conn = wev->conn;
-    monitor = node->parent;
+    node = krk_monitor_find_node_by_handle(echo->handle);
+    if (node == NULL 
+            || node->conn == NULL
+            || node->parent == NULL
+            || node->parent->checker != &icmp_checker) {
+        return NULL;
+    }
+
     icd = node->checker_data;
+    if (icd->sequence != echo->sequence) {
+        return NULL;
+    }
 
-    if (type == EV_WRITE) {
-        /* we've got a writable signal, send out the icmp packet */
-        packet = malloc(8 + KRK_ICMP_DATA_LEN);
-        if (packet == NULL) {
-            goto failed;
-        }
+    return node;
+}
 
-        memset(packet, 0, 8 + KRK_ICMP_DATA_LEN);
+/**
+ * icmp_batch_flush - send the queued echo requests
+ * @is: socket of the current loop
+ *
+ * one sendmmsg for the lot. a request the kernel refuses fails 
+ * its own probe only, what does not fit in the socket's buffer
+ * stays queued for the next tick.
+ */
+static void icmp_batch_flush(struct icmp_socket *is)
+{
+    struct icmp_batch *batch = is->batch;
+    struct krk_node *nodes[KRK_ICMP_SEND_BATCH];
+    struct krk_node *node;
+    struct msghdr *msg;
+    unsigned int i, nr, sent;
+    int ret;
 
-        icp = (struct krk_icmphdr *)packet;
-        icp->type = ICMP_ECHO;
-        icp->code = 0;
-        icp->checksum = 0;
-        icp->un.echo.sequence = htons(icd->sequence);
-        icp->un.echo.id = monitor->id << 8;
-        icp->un.echo.id |= node->id;
+    batch->kicked = 0;
 
-        icp->checksum = krk_in_cksum((unsigned short *)icp, 8 + KRK_ICMP_DATA_LEN, 0);
+    for (i = 0, nr = 0; i < batch->nr_echoes; i++) {
+        node = icmp_echo_node(&batch->echoes[i]);
+        if (node == NULL) {
+            continue;
+        }
 
-        /* schedule read handler */
-        conn->rev->timeout = malloc(sizeof(struct timeval));
-        if (!conn->rev->timeout) {
-            goto failed;
+        if (nr != i) {
+            batch->echoes[nr] = batch->echoes[i];
         }
 
-        conn->rev->timeout->tv_sec = monitor->timeout;
-        conn->rev->timeout->tv_usec = 0;
+        nodes[nr] = node;
 
-        ret = sendto(sock, packet, 8 + KRK_ICMP_DATA_LEN, 0, 
-                (struct sockaddr*)&node->inaddr, sizeof(struct sockaddr));
-        if (ret < 0) {
-            krk_log(KRK_LOG_DEBUG, "%s:%d, ret < 0\n", 
-                    __func__, __LINE__);
-            
-            krk_monitor_node_failure_inc(monitor, node);
+        batch->out_iov[nr].iov_base = batch->echoes[nr].packet;
+        batch->out_iov[nr].iov_len = KRK_ICMP_HDR_LEN + KRK_ICMP_DATA_LEN;
+
+        msg = &batch->out[nr].msg_hdr;
+        if (is->ipv6) {
+            /* raw icmpv6 refuses the port of the node */
+            batch->echoes[nr].to = node->in6addr;
+            batch->echoes[nr].to.sin6_port = 0;
+            msg->msg_name = &batch->echoes[nr].to;
+            msg->msg_namelen = sizeof(struct sockaddr_in6);
+        } else {
+            msg->msg_name = &node->inaddr;
+            msg->msg_namelen = sizeof(struct sockaddr_in);
+        }
+        msg->msg_iov = &batch->out_iov[nr];
+        msg->msg_iovlen = 1;
+
+        nr++;
+    }
 
-            //icmp_handle_same_addr_node(node);
+    sent = 0;
+    while (sent < nr) {
+        ret = icmp_send_batch(is->sock, batch, sent, nr - sent);
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
 
-            goto failed;
+        if (ret < 0 && errno == EINTR) {
+            continue;
         }
 
-        icd->sequence++;
+        if (ret == 0 || errno == EAGAIN 
+                || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            break;
+        }
 
-        krk_event_set_read(conn->sock, conn->rev);
-        krk_event_add(conn->rev);
-    } else if (type == EV_TIMEOUT) {
-        krk_log(KRK_LOG_DEBUG, "write timeout!\n");
-        
-        krk_monitor_node_failure_inc(monitor, node);
+        krk_log(KRK_LOG_DEBUG, "icmp echo to %s: %s\n", 
+                nodes[sent]->addr, strerror(errno));
 
-        goto failed;
+        icmp_echo_failed(nodes[sent]);
+        sent++;
     }
 
-out:
-    if (packet)
-        free(packet);
+    batch->nr_echoes = nr - sent;
+    if (batch->nr_echoes) {
+        memmove(batch->echoes, batch->echoes + sent, 
+                batch->nr_echoes * sizeof(struct icmp_echo));
 
-    return;
+        krk_event_set_timeout(batch->flush, 0);
+        krk_event_add(batch->flush);
+    }
+}
 
-failed:
-    krk_monitor_remove_node_connection(node, conn);
-    krk_connection_destroy(conn);
+static void icmp_flush_handler(int sock, short type, void *arg)
+{
+    struct krk_event *ev = arg;
 
-    goto out;
+    icmp_batch_flush(ev->data);
 }
 
-static int icmp_init_node(struct krk_node *node)
+/**
+ * icmp_build_echo - queue the echo request of a probe
+ * @node: node to ping
+ * @echo: free slot of the batch
+ *
+ */
+static void icmp_build_echo(struct krk_node *node, struct icmp_echo *echo)
 {
+    struct krk_icmphdr *icp;
+    struct krk_icmp_payload *payload;
     struct icmp_checker_data *icd;
-    struct krk_node nodes[256];
-    struct krk_monitor *monitor;
-    unsigned short n, i;
-
-    /**
-     * for icmp checker, if we have 
-     * more than one node with the 
-     * same address, consider them as 
-     * one.
-     *
-     * XXX: Temporarily disable this feature.
-     */
-#if 0
-    n = krk_monitor_get_nodes_by_addr(node->addr, nodes);
-    for (i = 0; i < n; i++) {
-        monitor = nodes[i].parent;
-        if (node == &nodes[i]) {
-            continue;
-        }
+    void *packet;
 
-        if (nodes[i].ready && 
-                !strcmp("icmp", monitor->checker->name)) {
-            return KRK_OK;
-        }
+    icd = node->checker_data;
+    icd->sequence++;
+
+    echo->handle = node->id;
+    echo->sequence = icd->sequence;
+
+    packet = echo->packet;
+    memset(packet, 0, KRK_ICMP_HDR_LEN + KRK_ICMP_DATA_LEN);
+
+    icp = (struct krk_icmphdr *)packet;
+    icp->type = icd->ipv6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+    icp->code = 0;
+    icp->checksum = 0;
+    /* the node's handle spans identifier and sequence */
+    icp->un.echo.id = htons(node->id >> 16);
+    icp->un.echo.sequence = htons(node->id & 0xffff);
+
+    payload = packet + KRK_ICMP_HDR_LEN;
+    payload->magic = htonl(KRK_ICMP_MAGIC);
+    payload->handle = htonl(node->id);
+    payload->sequence = htons(icd->sequence);
+
+    /* the icmpv6 checksum covers a pseudo header, the kernel does it */
+    if (!icd->ipv6) {
+        icp->checksum = krk_in_cksum((unsigned short *)icp, 
+                KRK_ICMP_HDR_LEN + KRK_ICMP_DATA_LEN, 0);
     }
-#endif
-    node->ready = 1;
+}
+
+static int icmp_init_node(struct krk_node *node)
+{
+    struct icmp_checker_data *icd;
 
     icd = malloc(sizeof(struct icmp_checker_data));
     if (icd == NULL) 
         return KRK_ERROR;
 
     memset(icd, 0, sizeof(struct icmp_checker_data));
+    icd->loop = node->parent->loop->id;
+    icd->ipv6 = node->state->key.ipv6;
     node->checker_data = icd;
 
+    icmp_sockets[icd->loop][icd->ipv6].nr_nodes++;
+
+    node->state->ready = 1;
+
     return KRK_OK;
 }
 
 static int icmp_cleanup_node(struct krk_node *node)
 {
     struct icmp_checker_data *icd;
+    struct icmp_socket *is;
 
-    node->ready = 0;
+    node->state->ready = 0;
     icd = node->checker_data;
 
+    /* init_node failed, nothing was set up */
+    if (icd == NULL) {
+        return KRK_OK;
+    }
+
+    /* the last node of a loop takes its socket along */
+    is = &icmp_sockets[icd->loop][icd->ipv6];
+    if (--is->nr_nodes == 0) {
+        icmp_socket_put(is);
+    }
+
     free(icd);
+    node->checker_data = NULL;
 
     return KRK_OK;
 }
 
 static int icmp_process_node(struct krk_node *node, void *param)
 {
-    int sock;
+    struct icmp_socket *is;
+    struct icmp_batch *batch;
     struct krk_connection *conn;
     struct krk_monitor *monitor;
 
     if (node->conn)
         return KRK_OK;
 
-    sock = krk_socket_raw_create(IPPROTO_ICMP);
-    if (sock < 0) {
+    is = icmp_socket_get(node->state->key.ipv6);
+    if (is == NULL) {
+        /* out of descriptors, not the node's fault */
+        if (errno == EMFILE || errno == ENFILE) {
+            return KRK_BUSY;
+        }
         return KRK_ERROR;
     }
 
+    /* the socket's buffer was full at the last flush */
+    batch = is->batch;
+    if (batch->nr_echoes == KRK_ICMP_SEND_BATCH) {
+        return KRK_BUSY;
+    }
+
+    /* no socket of its own, the connection keeps the probe's deadline */
     conn = krk_connection_create(node->addr, 0, 0);
     if (!conn) {
-        return KRK_ERROR;
+        return KRK_BUSY;
     }
 
-    conn->sock = sock;
-    conn->rev->handler = icmp_read_handler;
-    conn->wev->handler = icmp_write_handler;
-
-    conn->rev->data = node;
-    conn->wev->data = node;
-
     monitor = node->parent;
 
-    conn->wev->timeout = malloc(sizeof(struct timeval));
-    if (!conn->wev->timeout) {
-        krk_connection_destroy(conn);
-        return KRK_ERROR;
-    }
+    icmp_build_echo(node, &batch->echoes[batch->nr_echoes++]);
 
-    conn->wev->timeout->tv_sec = monitor->timeout;
-    conn->wev->timeout->tv_usec = 0;
+    conn->rev->handler = icmp_timeout_handler;
+    conn->rev->data = node;
 
-    krk_event_set_write(conn->sock, conn->wev);
-    krk_event_add(conn->wev);
+    krk_event_set_timer(conn->rev);
+    krk_event_set_timeout(conn->rev, monitor->timeout);
+    krk_event_add(conn->rev);
 
     krk_monitor_add_node_connection(node, conn);
 
+    /* the probes due in this tick go out together */
+    if (batch->nr_echoes == KRK_ICMP_SEND_BATCH) {
+        icmp_batch_flush(is);
+    } else if (!batch->kicked) {
+        batch->kicked = 1;
+        krk_event_active(batch->flush, EV_READ);
+    }
+
     return KRK_OK;
 }
-
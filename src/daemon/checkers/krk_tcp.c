@@ -50,8 +50,7 @@ static void tcp_write_handler(int sock, short type, void *arg)
     struct krk_connection *conn;
     struct krk_node *node;
     struct krk_monitor *monitor;
-    int ret, err;
-    socklen_t errlen;
+    int err;
 
     wev = arg;
     node = wev->data;
@@ -59,25 +58,19 @@ static void tcp_write_handler(int sock, short type, void *arg)
     monitor = node->parent;
 
     if (type == EV_WRITE) {
-        /* we've got a writable signal, check sockopt */
-        errlen = sizeof(err);
-        ret = getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &err, &errlen);
-        if (ret == 0) {
-            if (err == 0) {
-                krk_monitor_node_success_inc(monitor, node);
-
-                goto ok;
-            } else {
-                krk_log(KRK_LOG_DEBUG, "write failed(%d)!\n", errno);
-            }
+        /* we've got a writable signal, check the connect */
+        err = krk_connection_connect_error(conn);
+        if (err == 0) {
+            krk_monitor_node_success_inc(monitor, node);
+        } else {
+            krk_log(KRK_LOG_DEBUG, "write failed(%d)!\n", err);
+            krk_monitor_node_failure_inc(monitor, node);
         }
     } else if (type == EV_TIMEOUT) {
         krk_log(KRK_LOG_DEBUG, "write timeout!\n");
+        krk_monitor_node_timeout_inc(monitor, node);
     }
 
-    krk_monitor_node_failure_inc(monitor, node);
-
-ok:
     krk_monitor_remove_node_connection(node, conn);
     krk_connection_destroy(conn);
 }
@@ -85,7 +78,7 @@ ok:
 static int tcp_init_node(struct krk_node *node)
 {
     krk_log(KRK_LOG_DEBUG, "tcp init node, node: %s\n", node->addr);
-    node->ready = 1;
+    node->state->ready = 1;
 
     return KRK_OK;
 }
@@ -93,7 +86,7 @@ static int tcp_init_node(struct krk_node *node)
 static int tcp_cleanup_node(struct krk_node *node)
 {
     krk_log(KRK_LOG_DEBUG, "tcp cleanup node, node: %s\n", node->addr);
-    node->ready = 0;
+    node->state->ready = 0;
 
     return KRK_OK;
 }
@@ -104,14 +97,22 @@ static int tcp_process_node(struct krk_node *node, void *param)
     struct krk_connection *conn;
     struct krk_monitor *monitor;
 
+    if (node->conn)
+        return KRK_OK;
+
     sock = krk_socket_tcp_create(0);
     if (sock < 0) {
+        /* out of descriptors, not the node's fault */
+        if (errno == EMFILE || errno == ENFILE) {
+            return KRK_BUSY;
+        }
         return KRK_ERROR;
     }
 
     conn = krk_connection_create(node->addr, 0, 0);
     if (!conn) {
-        return KRK_ERROR;
+        krk_socket_close(sock);
+        return KRK_BUSY;
     }
 
     conn->sock = sock;
@@ -123,32 +124,18 @@ static int tcp_process_node(struct krk_node *node, void *param)
 
     monitor = node->parent;
 
-    /** 
-     * TODO:
-     * connect should be changed into
-     * common form, such as krk_socket_connect...
-     */
-    ret = connect(conn->sock, (struct sockaddr*)&node->inaddr, 
+    krk_event_set_timeout(conn->wev, monitor->timeout);
+
+    ret = krk_connection_connect(conn, (struct sockaddr*)&node->inaddr, 
             sizeof(struct sockaddr));
-    if (ret < 0 && errno != EINPROGRESS) {
+    if (ret == KRK_ERROR) {
         krk_connection_destroy(conn);
         krk_monitor_node_failure_inc(monitor, node);
         
         return KRK_ERROR;
     }
 
-    if (errno == EINPROGRESS) {
-        conn->wev->timeout = malloc(sizeof(struct timeval));
-        if (!conn->wev->timeout) {
-            krk_connection_destroy(conn);
-            return KRK_ERROR;
-        }
-
-        conn->wev->timeout->tv_sec = monitor->timeout;
-        conn->wev->timeout->tv_usec = 0;
-        krk_event_set_write(conn->sock, conn->wev);
-        krk_event_add(conn->wev);
-
+    if (ret == KRK_AGAIN) {
         krk_monitor_add_node_connection(node, conn);
 
         return KRK_OK;
@@ -0,0 +1,204 @@
+/**
+ * krk_arena.c - Krake bump arena
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <krk_core.h>
+#include <krk_arena.h>
+
+void krk_arena_init(struct krk_arena *arena);
+void* krk_arena_alloc(struct krk_arena *arena, size_t size);
+void* krk_arena_calloc(struct krk_arena *arena, size_t size);
+void krk_arena_mark(struct krk_arena *arena, struct krk_arena_mark *mark);
+void krk_arena_rewind(struct krk_arena *arena, struct krk_arena_mark *mark);
+void krk_arena_reset(struct krk_arena *arena);
+void krk_arena_destroy(struct krk_arena *arena);
+
+#define krk_arena_align(size) \
+    (((size) + KRK_ARENA_ALIGN - 1) & ~((size_t)KRK_ARENA_ALIGN - 1))
+
+static struct krk_arena_chunk* krk_arena_chunk_new(size_t size)
+{
+    struct krk_arena_chunk *chunk;
+
+    chunk = malloc(sizeof(struct krk_arena_chunk) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+
+    return chunk;
+}
+
+static void krk_arena_free_extra(struct krk_arena *arena, 
+        struct krk_arena_chunk *until)
+{
+    struct krk_arena_chunk *chunk;
+
+    while (arena->extra != until) {
+        chunk = arena->extra;
+        arena->extra = chunk->next;
+        free(chunk);
+    }
+}
+
+/**
+ * krk_arena_init - init an empty arena
+ * @arena: arena to init
+ *
+ * nothing is allocated until the first krk_arena_alloc.
+ */
+void krk_arena_init(struct krk_arena *arena)
+{
+    memset(arena, 0, sizeof(struct krk_arena));
+}
+
+/**
+ * krk_arena_alloc - allocate from an arena
+ * @arena: arena to allocate from
+ * @size: bytes wanted
+ *
+ * the memory is not zeroed and must not be freed,
+ * it goes away with krk_arena_reset.
+ *
+ * return address of memory for success;
+ * NULL for failed.
+ */
+void* krk_arena_alloc(struct krk_arena *arena, size_t size)
+{
+    struct krk_arena_chunk *chunk;
+    size_t chunk_size;
+    char *p;
+
+    size = krk_arena_align(size);
+
+    if (arena->head == NULL) {
+        arena->head = krk_arena_chunk_new(KRK_ARENA_CHUNK_SIZE);
+        if (arena->head == NULL) {
+            return NULL;
+        }
+
+        arena->pos = arena->head->data;
+        arena->end = arena->pos + KRK_ARENA_CHUNK_SIZE;
+    }
+
+    if ((size_t)(arena->end - arena->pos) < size) {
+        chunk_size = size > KRK_ARENA_CHUNK_SIZE ? size : KRK_ARENA_CHUNK_SIZE;
+
+        chunk = krk_arena_chunk_new(chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        chunk->next = arena->extra;
+        arena->extra = chunk;
+
+        arena->pos = chunk->data;
+        arena->end = arena->pos + chunk_size;
+        arena->nr_overflow++;
+    }
+
+    p = arena->pos;
+    arena->pos += size;
+    arena->nr_alloc++;
+
+    return p;
+}
+
+/**
+ * krk_arena_calloc - allocate zeroed memory from an arena
+ * @arena: arena to allocate from
+ * @size: bytes wanted
+ *
+ * return address of memory for success;
+ * NULL for failed.
+ */
+void* krk_arena_calloc(struct krk_arena *arena, size_t size)
+{
+    void *p;
+
+    p = krk_arena_alloc(arena, size);
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+
+    return p;
+}
+
+/**
+ * krk_arena_mark - remember where an arena is
+ * @arena: arena to mark
+ * @mark: filled with the current position
+ *
+ * for scratch memory that is only needed within one handler
+ * run, while the arena itself lives on.
+ */
+void krk_arena_mark(struct krk_arena *arena, struct krk_arena_mark *mark)
+{
+    mark->extra = arena->extra;
+    mark->pos = arena->pos;
+    mark->end = arena->end;
+}
+
+/**
+ * krk_arena_rewind - give back what was allocated after a mark
+ * @arena: arena to rewind
+ * @mark: taken by krk_arena_mark on the same arena
+ *
+ */
+void krk_arena_rewind(struct krk_arena *arena, struct krk_arena_mark *mark)
+{
+    krk_arena_free_extra(arena, mark->extra);
+
+    /* the very first alloc after the mark may have set up the head */
+    if (mark->pos == NULL) {
+        if (arena->head != NULL) {
+            arena->pos = arena->head->data;
+            arena->end = arena->pos + KRK_ARENA_CHUNK_SIZE;
+        }
+        return;
+    }
+
+    arena->pos = mark->pos;
+    arena->end = mark->end;
+}
+
+/**
+ * krk_arena_reset - give back everything allocated from an arena
+ * @arena: arena to reset
+ *
+ * overflow chunks are freed, the first chunk is kept
+ * for the next user.
+ */
+void krk_arena_reset(struct krk_arena *arena)
+{
+    krk_arena_free_extra(arena, NULL);
+
+    if (arena->head != NULL) {
+        arena->pos = arena->head->data;
+        arena->end = arena->pos + KRK_ARENA_CHUNK_SIZE;
+    }
+}
+
+/**
+ * krk_arena_destroy - free all memory of an arena
+ * @arena: arena to destroy
+ *
+ */
+void krk_arena_destroy(struct krk_arena *arena)
+{
+    krk_arena_free_extra(arena, NULL);
+
+    free(arena->head);
+
+    memset(arena, 0, sizeof(struct krk_arena));
+}
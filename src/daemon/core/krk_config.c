@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <limits.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 
@@ -23,8 +24,10 @@
 #include <krk_config.h>
 #include <krk_buffer.h>
 #include <krk_monitor.h>
+#include <krk_uring.h>
 #include <krk_log.h>
 #include <checkers/krk_checker.h>
+#include <checkers/krk_icmp.h>
 
 struct krk_config_param {
     xmlChar     *key;
@@ -245,6 +248,239 @@ static int krk_config_log_parse(struct krk_config_param *param, void *arg,
                     krk_config_log_parser_num, &conf->log, doc, cur);
 }
 
+static int krk_config_parse_time(const char *value, unsigned long *usec);
+
+static int krk_config_global_max_inflight(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int i = 0;
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    for (i = 0; i < strlen(config_value); i++) {
+        if (!isdigit(config_value[i])) {
+            krk_log(KRK_LOG_ALERT,"max_inflight configuration is not number!\n");
+            return KRK_ERROR;
+        }
+    }
+
+    global->max_inflight = atol(config_value);
+    if ((long)global->max_inflight <= 0) {
+        krk_log(KRK_LOG_ALERT,"max_inflight configuration must be positive!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_global_max_monitors(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int i = 0;
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    for (i = 0; i < strlen(config_value); i++) {
+        if (!isdigit(config_value[i])) {
+            krk_log(KRK_LOG_ALERT,"max_monitors configuration is not number!\n");
+            return KRK_ERROR;
+        }
+    }
+
+    global->max_monitors = atol(config_value);
+    if ((long)global->max_monitors <= 0) {
+        krk_log(KRK_LOG_ALERT,"max_monitors configuration must be positive!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_global_max_nodes(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int i = 0;
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    for (i = 0; i < strlen(config_value); i++) {
+        if (!isdigit(config_value[i])) {
+            krk_log(KRK_LOG_ALERT,"max_nodes configuration is not number!\n");
+            return KRK_ERROR;
+        }
+    }
+
+    global->max_nodes = atol(config_value);
+    if ((long)global->max_nodes <= 0) {
+        krk_log(KRK_LOG_ALERT,"max_nodes configuration must be positive!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_global_workers(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int i = 0;
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    for (i = 0; i < strlen(config_value); i++) {
+        if (!isdigit(config_value[i])) {
+            krk_log(KRK_LOG_ALERT,"workers configuration is not number!\n");
+            return KRK_ERROR;
+        }
+    }
+
+    global->workers = atol(config_value);
+    if (global->workers > KRK_EVENT_LOOP_MAX_WORKERS) {
+        krk_log(KRK_LOG_ALERT,"workers configuration is larger than %d!\n",
+                KRK_EVENT_LOOP_MAX_WORKERS);
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_global_io_engine(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    if (!strcmp(config_value, "libevent")) {
+        global->io_engine = KRK_CONF_IO_ENGINE_LIBEVENT;
+    } else if (!strcmp(config_value, "io_uring")) {
+        global->io_engine = KRK_CONF_IO_ENGINE_URING;
+    } else {
+        krk_log(KRK_LOG_ALERT,"io_engine configuration is not libevent or io_uring!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_global_icmp_socket(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    if (!strcmp(config_value, "auto")) {
+        global->icmp_socket = KRK_ICMP_SOCKET_AUTO;
+    } else if (!strcmp(config_value, "raw")) {
+        global->icmp_socket = KRK_ICMP_SOCKET_RAW;
+    } else if (!strcmp(config_value, "dgram")) {
+        global->icmp_socket = KRK_ICMP_SOCKET_DGRAM;
+    } else {
+        krk_log(KRK_LOG_ALERT,"icmp_socket configuration is not auto, raw or dgram!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_global_lag_threshold(struct krk_config_param *param, 
+                void *arg, xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_global *global = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &global->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    if (krk_config_parse_time(config_value, &global->lag_threshold) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"lag_threshold configuration is not a valid time!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static struct krk_config_parser krk_global_parser[] = {
+    {{"max_inflight", KRK_CONF_GLOBAL_MAX_INFLIGHT}, krk_config_global_max_inflight, 0},
+    {{"workers", KRK_CONF_GLOBAL_WORKERS}, krk_config_global_workers, 0},
+    {{"io_engine", KRK_CONF_GLOBAL_IO_ENGINE}, krk_config_global_io_engine, 0},
+    {{"lag_threshold", KRK_CONF_GLOBAL_LAG_THRESHOLD}, krk_config_global_lag_threshold, 0},
+    {{"max_monitors", KRK_CONF_GLOBAL_MAX_MONITORS}, krk_config_global_max_monitors, 0},
+    {{"max_nodes", KRK_CONF_GLOBAL_MAX_NODES}, krk_config_global_max_nodes, 0},
+    {{"icmp_socket", KRK_CONF_GLOBAL_ICMP_SOCKET}, krk_config_global_icmp_socket, 0},
+};
+
+#define krk_config_global_parser_num \
+    (sizeof(krk_global_parser)/sizeof(struct krk_config_parser))
+
+static int krk_config_global_parse(struct krk_config_param *param, void *arg,
+                    xmlDocPtr doc, xmlNodePtr cur) 
+{
+    struct krk_config *conf = arg;
+
+    if (param->cmd_label) {
+        if (conf->config & param->cmd_label) {
+            krk_log(KRK_LOG_ALERT,"%s configuration repeated!\n", param->key);
+            return KRK_ERROR;
+        }
+        conf->config |= param->cmd_label;
+    }
+
+    return krk_config_parse_xml_node(krk_global_parser, 
+                    krk_config_global_parser_num, &conf->global, doc, cur);
+}
+
 static int krk_config_monitor_name(struct krk_config_param *param, void *arg,
                     xmlDocPtr doc, xmlNodePtr cur)
 {
@@ -321,12 +557,52 @@ static int krk_config_monitor_checker_param(struct krk_config_param *param, void
     return KRK_OK;
 }
 
+/**
+ * krk_config_parse_time - parse a time value
+ * @value: time string, "250ms", "2s" or "2", a bare number means seconds
+ * @usec: where to store the parsed value, in microseconds
+ *
+ * return KRK_OK on success;
+ * KRK_ERROR for invalid values.
+ */
+static int krk_config_parse_time(const char *value, unsigned long *usec)
+{
+    unsigned long num = 0, unit;
+    int i;
+
+    for (i = 0; isdigit(value[i]); i++) {
+        if (num > (ULONG_MAX - 9) / 10) {
+            return KRK_ERROR;
+        }
+        num = num * 10 + (value[i] - '0');
+    }
+
+    if (i == 0) {
+        return KRK_ERROR;
+    }
+
+    if (!strcmp(value + i, "ms")) {
+        unit = 1000;
+    } else if (!strcmp(value + i, "s") || value[i] == 0) {
+        unit = 1000000;
+    } else {
+        return KRK_ERROR;
+    }
+
+    if (num > ULONG_MAX / unit) {
+        return KRK_ERROR;
+    }
+
+    *usec = num * unit;
+
+    return KRK_OK;
+}
+
 static int krk_config_monitor_interval(struct krk_config_param *param, void *arg,
                 xmlDocPtr doc, xmlNodePtr cur)
 {
     struct krk_config_monitor *monitor = arg;
     char config_value[KRK_CONFIG_MAX_LEN] = {};
-    int i = 0;
     int ret = 0;
 
     ret = krk_config_parse_first(param, config_value, 
@@ -336,27 +612,42 @@ static int krk_config_monitor_interval(struct krk_config_param *param, void *arg
         return KRK_ERROR;
     }
 
-    for (i = 0; i < strlen(config_value); i++) {
-        if (!isdigit(config_value[i])) {
-            krk_log(KRK_LOG_ALERT,"interval configuration is not number!\n");
-            return KRK_ERROR;
-        }
+    if (krk_config_parse_time(config_value, &monitor->interval) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"interval configuration is not a valid time!\n");
+        return KRK_ERROR;
     }
 
-    monitor->interval = atol(config_value);
-    if ((long)monitor->interval < 0) {
+    return KRK_OK;
+}
+
+static int krk_config_monitor_timeout(struct krk_config_param *param, void *arg,
+                xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_monitor *monitor = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &monitor->config, doc, cur);
+    if (ret < 0) {
+        krk_log(KRK_LOG_ALERT,"parse configuration first failed!\n");
+        return KRK_ERROR;
+    }
+
+    if (krk_config_parse_time(config_value, &monitor->timeout) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"timeout configuration is not a valid time!\n");
         return KRK_ERROR;
     }
 
     return KRK_OK;
 }
 
-static int krk_config_monitor_timeout(struct krk_config_param *param, void *arg,
+static int krk_config_monitor_jitter(struct krk_config_param *param, void *arg,
                 xmlDocPtr doc, xmlNodePtr cur)
 {
     struct krk_config_monitor *monitor = arg;
     char config_value[KRK_CONFIG_MAX_LEN] = {};
-    int i = 0;
     int ret = 0;
 
     ret = krk_config_parse_first(param, config_value, 
@@ -367,15 +658,77 @@ static int krk_config_monitor_timeout(struct krk_config_param *param, void *arg,
         return KRK_ERROR;
     }
 
-    for (i = 0; i < strlen(config_value); i++) {
-        if (!isdigit(config_value[i])) {
-            krk_log(KRK_LOG_ALERT,"timeout configuration is not number!\n");
-            return KRK_ERROR;
-        }
+    if (krk_config_parse_time(config_value, &monitor->jitter) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"jitter configuration is not a valid time!\n");
+        return KRK_ERROR;
     }
 
-    monitor->timeout = atol(config_value);
-    if ((long)monitor->timeout < 0) {
+    return KRK_OK;
+}
+
+static int krk_config_monitor_suspect_interval(struct krk_config_param *param, void *arg,
+                xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_monitor *monitor = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &monitor->config, doc, cur);
+    if (ret < 0) {
+        krk_log(KRK_LOG_ALERT,"parse configuration first failed!\n");
+        return KRK_ERROR;
+    }
+
+    if (krk_config_parse_time(config_value, &monitor->suspect_interval) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"suspect_interval configuration is not a valid time!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_monitor_stable_interval(struct krk_config_param *param, void *arg,
+                xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_monitor *monitor = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &monitor->config, doc, cur);
+    if (ret < 0) {
+        krk_log(KRK_LOG_ALERT,"parse configuration first failed!\n");
+        return KRK_ERROR;
+    }
+
+    if (krk_config_parse_time(config_value, &monitor->stable_interval) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"stable_interval configuration is not a valid time!\n");
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+static int krk_config_monitor_backoff_max(struct krk_config_param *param, void *arg,
+                xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_monitor *monitor = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &monitor->config, doc, cur);
+    if (ret < 0) {
+        krk_log(KRK_LOG_ALERT,"parse configuration first failed!\n");
+        return KRK_ERROR;
+    }
+
+    if (krk_config_parse_time(config_value, &monitor->backoff_max) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT,"backoff_max configuration is not a valid time!\n");
         return KRK_ERROR;
     }
 
@@ -442,6 +795,38 @@ static int krk_config_monitor_success_threshold(struct krk_config_param *param,
     return KRK_OK;
 }
 
+static int krk_config_monitor_priority(struct krk_config_param *param, void *arg,
+                xmlDocPtr doc, xmlNodePtr cur)
+{
+    struct krk_config_monitor *monitor = arg;
+    char config_value[KRK_CONFIG_MAX_LEN] = {};
+    int i = 0;
+    int ret = 0;
+
+    ret = krk_config_parse_first(param, config_value, 
+                        sizeof(config_value),  
+                        &monitor->config, doc, cur);
+    if (ret < 0) {
+        return KRK_ERROR;
+    }
+
+    for (i = 0; i < strlen(config_value); i++) {
+        if (!isdigit(config_value[i])) {
+            krk_log(KRK_LOG_ALERT,"priority configuration is not number!\n");
+            return KRK_ERROR;
+        }
+    }
+
+    monitor->priority = atol(config_value);
+    if (monitor->priority > KRK_CONF_MAX_PRIORITY) {
+        krk_log(KRK_LOG_ALERT,"priority configuration is bigger than %d!\n",
+                KRK_CONF_MAX_PRIORITY);
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
 static int krk_config_monitor_script(struct krk_config_param *param, void *arg,
                 xmlDocPtr doc, xmlNodePtr cur)
 {
@@ -467,8 +852,13 @@ static struct krk_config_parser krk_monitor_parser[] = {
     {{"checker_param", KRK_CONF_MONITOR_CHECKER_PARAM}, krk_config_monitor_checker_param, 0},
     {{"interval", KRK_CONF_MONITOR_INTERVAL}, krk_config_monitor_interval, 1},
     {{"timeout", KRK_CONF_MONITOR_TIMEOUT}, krk_config_monitor_timeout, 1},
+    {{"jitter", KRK_CONF_MONITOR_JITTER}, krk_config_monitor_jitter, 0},
+    {{"suspect_interval", KRK_CONF_MONITOR_SUSPECT_INTERVAL}, krk_config_monitor_suspect_interval, 0},
+    {{"stable_interval", KRK_CONF_MONITOR_STABLE_INTERVAL}, krk_config_monitor_stable_interval, 0},
+    {{"backoff_max", KRK_CONF_MONITOR_BACKOFF_MAX}, krk_config_monitor_backoff_max, 0},
     {{"failure_threshold", KRK_CONF_MONITOR_F_THRESHOLD}, krk_config_monitor_failure_threshold, 1},
     {{"success_threshold", KRK_CONF_MONITOR_S_THRESHOLD}, krk_config_monitor_success_threshold, 1},
+    {{"priority", KRK_CONF_MONITOR_PRIORITY}, krk_config_monitor_priority, 0},
     {{"script", KRK_CONF_MONITOR_SCRIPT}, krk_config_monitor_script, 0},
     {{"node", 0}, krk_config_monitor_node, 0},
 };
@@ -499,11 +889,59 @@ static int krk_config_monitor_parse(struct krk_config_param *param, void *arg,
     }
 
     if (monitor->interval <= monitor->timeout) {
-        krk_log(KRK_LOG_ALERT,"Error! interval(%lu) is not bigger than timeout(%lu)!\n",
+        krk_log(KRK_LOG_ALERT,"Error! interval(%luus) is not bigger than timeout(%luus)!\n",
                 monitor->interval, monitor->timeout);
         return KRK_ERROR;
     }
 
+    /* by default spread the probes over the whole interval */
+    if (!(monitor->config & KRK_CONF_MONITOR_JITTER)) {
+        monitor->jitter = monitor->interval;
+    }
+
+    if (monitor->jitter > monitor->interval) {
+        krk_log(KRK_LOG_ALERT,"Error! jitter(%luus) is bigger than interval(%luus)!\n",
+                monitor->jitter, monitor->interval);
+        return KRK_ERROR;
+    }
+
+    /* adaptive probing is off unless one of these is set */
+    if (!(monitor->config & KRK_CONF_MONITOR_SUSPECT_INTERVAL)) {
+        monitor->suspect_interval = monitor->interval;
+    }
+
+    if (!(monitor->config & KRK_CONF_MONITOR_STABLE_INTERVAL)) {
+        monitor->stable_interval = monitor->interval;
+    }
+
+    if (monitor->suspect_interval > monitor->interval
+            || monitor->suspect_interval <= monitor->timeout) {
+        krk_log(KRK_LOG_ALERT,"Error! suspect_interval(%luus) must be in (timeout, interval]!\n",
+                monitor->suspect_interval);
+        return KRK_ERROR;
+    }
+
+    if (monitor->stable_interval < monitor->interval) {
+        krk_log(KRK_LOG_ALERT,"Error! stable_interval(%luus) is smaller than interval(%luus)!\n",
+                monitor->stable_interval, monitor->interval);
+        return KRK_ERROR;
+    }
+
+    if (!(monitor->config & KRK_CONF_MONITOR_PRIORITY)) {
+        monitor->priority = KRK_CONF_DEFAULT_PRIORITY;
+    }
+
+    /* down nodes do not back off unless a cap is given */
+    if (!(monitor->config & KRK_CONF_MONITOR_BACKOFF_MAX)) {
+        monitor->backoff_max = monitor->interval;
+    }
+
+    if (monitor->backoff_max < monitor->interval) {
+        krk_log(KRK_LOG_ALERT,"Error! backoff_max(%luus) is smaller than interval(%luus)!\n",
+                monitor->backoff_max, monitor->interval);
+        return KRK_ERROR;
+    }
+
     return KRK_OK;
 }
 
@@ -542,6 +980,7 @@ static void krk_config_free(struct krk_config *conf)
 static struct krk_config_parser krk_parser[] = {
     {{"monitor", 0}, krk_config_monitor_parse, 0},
     {{"log", KRK_CONF_MONITOR_SCRIPT}, krk_config_log_parse, 0},
+    {{"global", KRK_CONF_GLOBAL}, krk_config_global_parse, 0},
 };
 
 #define krk_config_parser_num \
@@ -607,28 +1046,178 @@ static int krk_config_process_log(struct krk_config_log *log)
     return krk_log_set_type(log->log_type, log->log_level);
 }
 
+static int krk_config_process_global(struct krk_config_global *global) 
+{
+    unsigned long max_inflight = KRK_CONF_DEFAULT_MAX_INFLIGHT;
+    unsigned long lag_threshold = KRK_CONF_DEFAULT_LAG_THRESHOLD;
+    unsigned long max_monitors = KRK_CONF_DEFAULT_MAX_MONITORS;
+    unsigned long max_nodes = KRK_CONF_DEFAULT_MAX_NODES;
+    unsigned int nr_workers;
+
+    if (global->config & KRK_CONF_GLOBAL_MAX_INFLIGHT) {
+        max_inflight = global->max_inflight;
+    }
+
+    /* the budget is split evenly over the workers */
+    nr_workers = krk_event_loop_nr_workers();
+    if (nr_workers) {
+        max_inflight = (max_inflight + nr_workers - 1) / nr_workers;
+    }
+
+    /* leave some room for the control connections */
+    krk_connection_set_max(max_inflight + KRK_CONNECTION_RESERVED);
+    krk_monitor_set_max_inflight(max_inflight);
+
+    /* probes in flight finish on the engine they started with */
+    krk_uring_set_enabled(global->io_engine == KRK_CONF_IO_ENGINE_URING);
+
+    /* open icmp sockets keep their kind */
+    krk_icmp_set_socket_type(global->icmp_socket);
+
+    if (global->config & KRK_CONF_GLOBAL_LAG_THRESHOLD) {
+        lag_threshold = global->lag_threshold;
+    }
+
+    krk_event_set_lag_threshold(lag_threshold);
+
+    if (global->config & KRK_CONF_GLOBAL_MAX_MONITORS) {
+        max_monitors = global->max_monitors;
+    }
+
+    if (global->config & KRK_CONF_GLOBAL_MAX_NODES) {
+        max_nodes = global->max_nodes;
+    }
+
+    if (max_nodes > KRK_NODE_MAX_NUM) {
+        krk_log(KRK_LOG_ALERT, "max_nodes %lu is over the limit %u, cut\n", 
+                max_nodes, KRK_NODE_MAX_NUM);
+    }
+
+    krk_monitor_set_limits(max_monitors, max_nodes);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_config_monitor_changed - does a reload change how a monitor probes
+ * @conf_monitor: the new config of the monitor
+ * @monitor: the running monitor
+ * @checker: checker of the new config
+ * @ssl: the new config is https
+ *
+ * thresholds, priority and the adaptive intervals are taken
+ * on the fly, the node states are adapted to them with the 
+ * next results.
+ *
+ * return 1 if the probes of the monitor have to be restarted;
+ * 0 otherwise.
+ */
+static int krk_config_monitor_changed(struct krk_config_monitor *conf_monitor, 
+                    struct krk_monitor *monitor, struct krk_checker *checker,
+                    unsigned int ssl)
+{
+    if (monitor->checker != checker
+            || monitor->ssl_flag != ssl
+            || monitor->interval != conf_monitor->interval
+            || monitor->timeout != conf_monitor->timeout
+            || monitor->jitter != conf_monitor->jitter) {
+        return 1;
+    }
+
+    if (monitor->checker_param_len != conf_monitor->checker_param_len) {
+        return 1;
+    }
+
+    if (monitor->checker_param_len 
+            && memcmp(monitor->checker_param, conf_monitor->checker_param,
+                monitor->checker_param_len)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * krk_config_save_checker_param - keep the checker param a monitor runs with
+ * @conf_monitor: the new config of the monitor
+ * @monitor: the monitor
+ *
+ * compared against on the next reload.
+ *
+ * return KRK_OK for success;
+ * KRK_ERROR for out of memory.
+ */
+static int krk_config_save_checker_param(struct krk_config_monitor *conf_monitor, 
+                    struct krk_monitor *monitor)
+{
+    if (monitor->checker_param) {
+        free(monitor->checker_param);
+        monitor->checker_param = NULL;
+        monitor->checker_param_len = 0;
+    }
+
+    if (conf_monitor->checker_param_len == 0) {
+        return KRK_OK;
+    }
+
+    monitor->checker_param = malloc(conf_monitor->checker_param_len);
+    if (monitor->checker_param == NULL) {
+        return KRK_ERROR;
+    }
+
+    memcpy(monitor->checker_param, conf_monitor->checker_param, 
+            conf_monitor->checker_param_len);
+    monitor->checker_param_len = conf_monitor->checker_param_len;
+
+    return KRK_OK;
+}
+
 static int krk_config_update_monitor(struct krk_config_monitor *conf_monitor, 
                     struct krk_monitor *monitor) 
 {
     struct krk_checker *checker = NULL;
     struct krk_config_node *conf_node = NULL;
     struct krk_node *node = NULL;
+    struct krk_event_loop *saved;
+    unsigned int ssl, changed;
     int ret = KRK_OK;
 
-    krk_monitor_disable(monitor);
+    /* the monitor's events live on the loop owning it */
+    saved = krk_event_loop_switch(monitor->loop);
+
+    ssl = !strcmp(conf_monitor->checker, "https");
+    if (ssl) {
+        strncpy(conf_monitor->checker, "http",KRK_NAME_LEN);
+    }
+
+    checker = krk_checker_find(conf_monitor->checker);
+    if (checker == NULL) {
+        ret = KRK_ERROR;
+        goto out;
+    }
+
+    /* the nodes of an unchanged monitor keep their deadlines and intervals */
+    changed = krk_config_monitor_changed(conf_monitor, monitor, checker, ssl);
+    if (changed) {
+        krk_monitor_disable(monitor);
+    }
 
     monitor->interval = conf_monitor->interval;
     monitor->timeout = conf_monitor->timeout;
+    monitor->jitter = conf_monitor->jitter;
+    monitor->suspect_interval = conf_monitor->suspect_interval;
+    monitor->stable_interval = conf_monitor->stable_interval;
+    monitor->backoff_max = conf_monitor->backoff_max;
     monitor->failure_threshold = conf_monitor->failure_threshold;
     monitor->success_threshold = conf_monitor->success_threshold;
+    monitor->priority = conf_monitor->priority;
 
-    if (!strcmp(conf_monitor->checker, "https")) {
-        monitor->ssl_flag = 1;
+    monitor->ssl_flag = ssl;
+    if (ssl && monitor->ssl == NULL) {
         if (krk_monitor_init_ssl(monitor) != KRK_OK) {
             ret = KRK_ERROR;
             goto out;
         }
-        strncpy(conf_monitor->checker, "http",KRK_NAME_LEN);
     }
 
     if (conf_monitor->script[0]) {
@@ -640,12 +1229,6 @@ static int krk_config_update_monitor(struct krk_config_monitor *conf_monitor,
         }
     }
 
-    checker = krk_checker_find(conf_monitor->checker);
-    if (checker == NULL) {
-        ret = KRK_ERROR;
-        goto out;
-    }
-
     /* if checker has been changed, remove & destroy all nodes before assign
      * new checker to monitor
      */
@@ -660,7 +1243,7 @@ static int krk_config_update_monitor(struct krk_config_monitor *conf_monitor,
         monitor->checker = checker;
     }
 
-    if (checker->parse_param) {
+    if (changed && checker->parse_param) {
         if (monitor->parsed_checker_param) {
             free(monitor->parsed_checker_param);
             monitor->parsed_checker_param = NULL;
@@ -673,9 +1256,16 @@ static int krk_config_update_monitor(struct krk_config_monitor *conf_monitor,
         }
     }
 
+    if (changed) {
+        ret = krk_config_save_checker_param(conf_monitor, monitor);
+        if (ret != KRK_OK) {
+            goto out;
+        }
+    }
+
     ret = krk_remove_unused_node(conf_monitor, monitor);
     if (ret == KRK_ERROR) {
-        return ret;
+        goto out;
     }
 
     conf_node = conf_monitor->node;
@@ -692,6 +1282,7 @@ static int krk_config_update_monitor(struct krk_config_monitor *conf_monitor,
             ret = krk_monitor_add_node(monitor, node);
             if (ret == KRK_ERROR) {
                 krk_log(KRK_LOG_ALERT,"add node failed!\n");
+                krk_monitor_destroy_node(node);
                 goto out;
             }
         }
@@ -706,6 +1297,8 @@ static int krk_config_update_monitor(struct krk_config_monitor *conf_monitor,
     }
 
 out:
+    krk_event_loop_switch(saved);
+
     return ret;
 }
 
@@ -734,6 +1327,12 @@ static int krk_config_process(struct krk_config *conf)
         return ret;
     }
 
+    ret = krk_config_process_global(&conf->global);
+    if (ret == KRK_ERROR) {
+        krk_log(KRK_LOG_ALERT,"process global failed!\n");
+        return ret;
+    }
+
     ret = krk_remove_unused_monitor(conf);
     if (ret == KRK_ERROR) {
         krk_log(KRK_LOG_ALERT,"remove unused monitor failed!\n");
@@ -773,23 +1372,71 @@ int krk_config_load(char *config_file)
         goto out;
     }
 
+    /* only the first load starts the workers */
+    ret = krk_event_loops_start(conf.global.workers);
+    if (ret == KRK_ERROR) {
+        krk_log(KRK_LOG_ALERT,"start workers failed!\n");
+        goto out;
+    }
+
+    krk_event_loops_pause();
+
+    /* queued results may point to nodes about to go */
+    krk_monitor_results_flush();
+
     ret = krk_config_process(&conf);
     if (ret == KRK_ERROR) {
         krk_log(KRK_LOG_ALERT,"process config failed!\n");
         krk_all_monitors_destroy();
     }
+
+    krk_event_loops_resume();
 out:
     krk_config_free(&conf);
 
     return ret;
 }
 
+/**
+ * krk_config_reserve_info - make room for the info of the monitors
+ * @wev: write event of the config connection
+ * @monitor: monitor to send the info of, NULL for the names of all
+ *
+ * a reload may have come in since the buffer was sized on accept.
+ *
+ * return KRK_OK on success, KRK_ERROR if out of memory.
+ */
+static int krk_config_reserve_info(struct krk_event *wev, 
+        struct krk_monitor *monitor)
+{
+    struct krk_buffer *buf;
+    size_t size;
+
+    size = (wev->buf->last - wev->buf->head) + krk_info_buffer_size(monitor);
+
+    buf = krk_buffer_resize(wev->buf, size);
+    if (buf == NULL) {
+        return KRK_ERROR;
+    }
+
+    wev->buf = buf;
+
+    return KRK_OK;
+}
+
 static void krk_config_process_one_monitor(struct krk_connection *conn, struct krk_monitor *monitor)
 {
     int buf_size = 0;
     struct krk_event *wev = conn->wev;
     struct krk_monitor_info *m_info;
-    void *buf = wev->buf->pos;
+    void *buf;
+
+    if (krk_config_reserve_info(wev, monitor) != KRK_OK) {
+        krk_connection_destroy(conn);
+        return;
+    }
+
+    buf = wev->buf->pos;
 
     m_info = buf;
     krk_get_monitor_info(m_info, monitor);
@@ -805,7 +1452,14 @@ static void krk_config_process_all_monitor(struct krk_connection *conn)
 {
     int buf_size = 0;
     struct krk_event *wev = conn->wev;
-    void *buf = wev->buf->pos;
+    void *buf;
+
+    if (krk_config_reserve_info(wev, NULL) != KRK_OK) {
+        krk_connection_destroy(conn);
+        return;
+    }
+
+    buf = wev->buf->pos;
 
     buf_size = krk_get_all_monitor_name(buf);
     wev->buf->last += buf_size;
@@ -853,7 +1507,9 @@ void krk_config_read(int sock, short type, void *arg)
                 krk_connection_destroy(conn);
                 break;
             }
+            krk_event_loops_pause();
             krk_config_process_one_monitor(conn, monitor);
+            krk_event_loops_resume();
             break;
         case KRK_CONF_RET_SHOW_ALL_MONITOR:
             krk_config_process_all_monitor(conn);
@@ -13,38 +13,49 @@
 #include <krk_core.h>
 #include <krk_event.h>
 #include <krk_connection.h>
+#include <krk_config.h>
+#include <krk_pool.h>
+#include <krk_buffer.h>
+#include <krk_uring.h>
 
 struct krk_connection* krk_connection_create(const char *name, size_t rbufsz, size_t wbufsz);
 int krk_connection_destroy(struct krk_connection *conn);
 int krk_connection_init(void);
+void krk_connection_set_max(unsigned int max);
 int krk_all_connections_destroy(void);
 int krk_connection_exit(void);
-
-
-LIST_HEAD(krk_all_connections);
-unsigned int krk_max_connections = 0;
-unsigned int krk_nr_connections = 0;
+void krk_connection_show(void);
+int krk_connection_connect(struct krk_connection *conn, 
+        const struct sockaddr *addr, socklen_t addrlen);
+int krk_connection_connect_error(struct krk_connection *conn);
+void krk_connection_wait_write(struct krk_connection *conn);
+void krk_connection_wait_read(struct krk_connection *conn, 
+        char *buf, size_t size);
+void krk_connection_read_more(struct krk_connection *conn, 
+        char *buf, size_t size);
 
 
 /**
- * krk_connection_create - create a new connection
- * @name: name of the new connection
- * @rbufsz: size of read buffer, 0 for default
- * @wbufsz: size of write buffer, 0 for default
- *
- * 
- * return address of new connection for success;
- * NULL for failed.
+ * every event loop owns its connections, they are only
+ * touched from the thread running that loop.
  */
-struct krk_connection* 
-krk_connection_create(const char *name, size_t rbufsz, size_t wbufsz)
+struct krk_connection_shard {
+    struct list_head all_connections;
+    unsigned int max_connections;
+    unsigned int nr_connections;
+
+    struct krk_pool pool;
+};
+
+static struct krk_connection_shard krk_connection_shards[KRK_EVENT_LOOP_MAX];
+
+#define krk_connection_shard() (&krk_connection_shards[krk_current_loop->id])
+
+
+static struct krk_connection* krk_connection_new(size_t rbufsz, size_t wbufsz)
 {
     struct krk_connection *conn;
 
-    if (krk_nr_connections == krk_max_connections) {
-        return NULL;
-    }
-
     conn = malloc(sizeof(struct krk_connection));
     if (!conn) {
         return NULL;
@@ -70,14 +81,147 @@ krk_connection_create(const char *name, size_t rbufsz, size_t wbufsz)
         conn->wev->conn = conn;
     }
 
+    INIT_LIST_HEAD(&conn->list);
+    conn->sock = -1;
+
+    return conn;
+}
+
+static void krk_connection_free(struct krk_connection *conn)
+{
+    krk_event_destroy(conn->rev);
+    krk_event_destroy(conn->wev);
+
+    krk_arena_destroy(&conn->arena);
+
+    free(conn);
+}
+
+static struct list_head* krk_connection_pool_alloc(void)
+{
+    struct krk_connection *conn;
+
+    conn = krk_connection_new(0, 0);
+    if (!conn) {
+        return NULL;
+    }
+
+    conn->pooled = 1;
+
+    return &conn->list;
+}
+
+static void krk_connection_pool_release(struct list_head *item)
+{
+    krk_connection_free(list_entry(item, struct krk_connection, list));
+}
+
+/**
+ * krk_connection_recycle - put a connection back to the pool
+ * @conn: connection to recycle, already closed and unlinked
+ *
+ * the connection, its event pair, their buffers and the
+ * first arena chunk are kept allocated, only their state
+ * is reset.
+ */
+static void krk_connection_recycle(struct krk_connection *conn)
+{
+    struct krk_event *rev, *wev;
+    struct krk_arena arena;
+
+    rev = conn->rev;
+    wev = conn->wev;
+
+    krk_event_reset(rev);
+    krk_event_reset(wev);
+
+    krk_arena_reset(&conn->arena);
+    arena = conn->arena;
+
+    memset(conn, 0, sizeof(struct krk_connection));
+
+    conn->rev = rev;
+    conn->wev = wev;
+    conn->arena = arena;
+    conn->sock = -1;
+    conn->pooled = 1;
+
+    krk_pool_put(&krk_connection_shard()->pool, &conn->list);
+}
+
+/**
+ * krk_connection_release - recycle or free a destroyed connection
+ * @conn: connection closed and unlinked, no io in flight
+ *
+ */
+static void krk_connection_release(struct krk_connection *conn)
+{
+    if (conn->pooled) {
+        krk_connection_recycle(conn);
+    } else {
+        krk_connection_free(conn);
+    }
+}
+
+/**
+ * krk_connection_uring_done - the kernel is done with a cancelled op
+ * @event: event of a destroyed connection
+ *
+ * the connection is released with the last of its ops.
+ */
+static void krk_connection_uring_done(struct krk_event *event)
+{
+    struct krk_connection *conn = event->conn;
+
+    if (--conn->nr_cancelled == 0) {
+        krk_connection_release(conn);
+    }
+}
+
+/**
+ * krk_connection_create - create a new connection
+ * @name: name of the new connection
+ * @rbufsz: size of read buffer, 0 for default
+ * @wbufsz: size of write buffer, 0 for default
+ *
+ * connections with default buffers, i.e. all the probes, 
+ * are taken from the connection pool.
+ * 
+ * return address of new connection for success;
+ * NULL for failed.
+ */
+struct krk_connection* 
+krk_connection_create(const char *name, size_t rbufsz, size_t wbufsz)
+{
+    struct krk_connection_shard *shard = krk_connection_shard();
+    struct krk_connection *conn;
+    struct list_head *item;
+
+    if (shard->nr_connections >= shard->max_connections) {
+        return NULL;
+    }
+
+    if (rbufsz == 0 && wbufsz == 0) {
+        item = krk_pool_get(&shard->pool);
+        if (!item) {
+            return NULL;
+        }
+        conn = list_entry(item, struct krk_connection, list);
+    } else {
+        conn = krk_connection_new(rbufsz, wbufsz);
+        if (!conn) {
+            return NULL;
+        }
+    }
+
     if (name) {
         strncpy(conn->name, name, KRK_NAME_LEN);
         conn->name[KRK_NAME_LEN - 1] = 0;
     }
 
-    list_add_tail(&conn->list, &krk_all_connections);
+    list_add_tail(&conn->list, &shard->all_connections);
 
-    krk_nr_connections++;
+    shard->nr_connections++;
     
     conn->recv = krk_connection_recv;
     conn->send = krk_connection_send;
@@ -99,10 +243,22 @@ int krk_connection_destroy(struct krk_connection *conn)
         return KRK_ERROR;
     }
 
-    krk_event_destroy(conn->rev);
-    krk_event_destroy(conn->wev);
+    /* events go first, they must not be pending on a closed fd */
+    krk_event_del(conn->rev);
+    krk_event_del(conn->wev);
 
-    close(conn->sock);
+    if (krk_uring_cancel(conn->rev, krk_connection_uring_done) == KRK_AGAIN) {
+        conn->nr_cancelled++;
+    }
+    if (krk_uring_cancel(conn->wev, krk_connection_uring_done) == KRK_AGAIN) {
+        conn->nr_cancelled++;
+    }
+
+    if (conn->sock >= 0) {
+        if (!conn->uring || krk_uring_close(conn->sock) != KRK_OK) {
+            close(conn->sock);
+        }
+    }
 
     list_del(&conn->list);
 
@@ -110,9 +266,14 @@ int krk_connection_destroy(struct krk_connection *conn)
         krk_ssl_destroy_connection(conn->ssl);
     }
 
-    free(conn);
+    krk_connection_shard()->nr_connections--;
+
+    /* the kernel may still write into it, krk_connection_uring_done */
+    if (conn->nr_cancelled) {
+        return KRK_OK;
+    }
 
-    krk_nr_connections--;
+    krk_connection_release(conn);
 
     return KRK_OK;
 }
@@ -121,6 +282,8 @@ int krk_connection_destroy(struct krk_connection *conn)
  * krk_all_connections_destroy - destroy all connections
  * @
  * 
+ * only the connections of the current loop.
+ *
  * return 0 for success;
  * -1 for failed.
  */
@@ -130,7 +293,7 @@ int krk_all_connections_destroy(void)
     struct krk_connection *tmp;
     int ret = KRK_OK;
 
-    list_for_each_safe(p, n, &krk_all_connections) {
+    list_for_each_safe(p, n, &krk_connection_shard()->all_connections) {
         tmp = list_entry(p, struct krk_connection, list);
         if (krk_connection_destroy(tmp)) {
             ret = KRK_ERROR;
@@ -142,16 +305,326 @@ int krk_all_connections_destroy(void)
 
 int krk_connection_init(void)
 {
-    INIT_LIST_HEAD(&krk_all_connections);
+    struct krk_connection_shard *shard;
+    int i;
+
+    for (i = 0; i < KRK_EVENT_LOOP_MAX; i++) {
+        shard = &krk_connection_shards[i];
+
+        INIT_LIST_HEAD(&shard->all_connections);
+
+        shard->max_connections = KRK_CONF_DEFAULT_MAX_INFLIGHT 
+            + KRK_CONNECTION_RESERVED;
 
-    krk_max_connections = 1024;
+        krk_pool_init(&shard->pool, "connection",
+                krk_connection_pool_alloc, krk_connection_pool_release);
+    }
 
     return KRK_OK;
 }
 
+/**
+ * krk_connection_set_max - change the connection limit
+ * @max: new limit, for each event loop
+ *
+ * connections already open are kept when the limit is lowered,
+ * only new ones are refused until the count drops below it.
+ */
+void krk_connection_set_max(unsigned int max)
+{
+    int i;
+
+    for (i = 0; i < KRK_EVENT_LOOP_MAX; i++) {
+        krk_connection_shards[i].max_connections = max;
+    }
+}
+
+/**
+ * krk_connection_exit - destroy the connections of all loops
+ * @
+ *
+ * the workers must have been stopped.
+ */
 int krk_connection_exit(void)
 {
-    return krk_all_connections_destroy();
+    struct krk_event_loop *saved;
+    unsigned int i;
+    int ret = KRK_OK;
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        saved = krk_event_loop_switch(krk_event_loop_get(i));
+
+        if (krk_all_connections_destroy()) {
+            ret = KRK_ERROR;
+        }
+
+        /* the cancelled ones come back to the pool */
+        krk_uring_drain();
+
+        krk_pool_destroy(&krk_connection_shard()->pool);
+
+        krk_event_loop_switch(saved);
+    }
+
+    return ret;
+}
+
+void krk_connection_show(void)
+{
+    struct krk_connection_shard *shard;
+    unsigned int i;
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        shard = &krk_connection_shards[i];
+
+        fprintf(stderr,"loop %u: connections = %u/%u\n",
+                i, shard->nr_connections, shard->max_connections);
+        krk_pool_show(&shard->pool);
+    }
+}
+
+static ssize_t 
+krk_connection_uring_recv(struct krk_connection *conn, u_char *buf, size_t size)
+{
+    struct krk_event *rev = conn->rev;
+
+    if (rev->result < 0) {
+        errno = -rev->result;
+        return -1;
+    }
+
+    /* received into the connection's buffer, see krk_connection_uring_read */
+    if ((size_t)rev->result > size) {
+        rev->result = size;
+    }
+
+    memcpy(buf, rev->buf->head, rev->result);
+
+    return rev->result;
+}
+
+/**
+ * krk_connection_uring_read - queue a recv into conn->rev's buffer
+ * @conn: connected connection
+ * @size: room in the caller's buffer
+ *
+ * the kernel only writes into memory of the connection, which
+ * a destroy keeps until the recv is over. the caller's buffer
+ * may go away meanwhile, e.g. with its node on a reload.
+ *
+ * return KRK_OK if the recv is queued;
+ * KRK_BUSY if the caller should use libevent instead.
+ */
+static int krk_connection_uring_read(struct krk_connection *conn, size_t size)
+{
+    struct krk_buffer *buf = conn->rev->buf;
+
+    if (size > buf->size) {
+        size = buf->size;
+    }
+
+    return krk_uring_recv(conn->rev, buf->head, size);
+}
+
+/**
+ * krk_connection_uring_send - send through io_uring
+ * @conn: connection whose conn->wev handler sends
+ * @buf: data to send
+ * @size: length of data
+ *
+ * the first call queues the send and fails with EAGAIN, the
+ * handler of conn->wev gets EV_WRITE or EV_TIMEOUT once it is 
+ * over. called again from there, buf is not looked at, the
+ * result of the send is returned.
+ */
+static ssize_t 
+krk_connection_uring_send(struct krk_connection *conn, u_char *buf, size_t size)
+{
+    if (conn->sending) {
+        conn->sending = 0;
+
+        if (conn->wev->result < 0) {
+            errno = -conn->wev->result;
+            return -1;
+        }
+
+        return conn->wev->result;
+    }
+
+    if (krk_uring_send(conn->wev, buf, size) != KRK_OK) {
+        return send(conn->sock, buf, size, 0);
+    }
+
+    conn->sending = 1;
+
+    /* only the timeout part */
+    krk_event_set_timer(conn->wev);
+    conn->wev->sock = conn->sock;
+    krk_event_add(conn->wev);
+
+    errno = EAGAIN;
+    return -1;
+}
+
+/**
+ * krk_connection_connect - start connecting a connection
+ * @conn: connection with its socket created
+ * @addr: address to connect to, valid until the connect completes
+ * @addrlen: length of addr
+ *
+ * the timeout, handler and data of conn->wev must be set. the
+ * connect goes through io_uring if enabled, otherwise libevent
+ * reports the socket writable. either way, the handler of 
+ * conn->wev gets EV_WRITE or EV_TIMEOUT, then it asks
+ * krk_connection_connect_error about the outcome.
+ *
+ * return KRK_OK if connected already, the handler is not called;
+ * KRK_AGAIN if in progress;
+ * KRK_ERROR for failed.
+ */
+int krk_connection_connect(struct krk_connection *conn, 
+        const struct sockaddr *addr, socklen_t addrlen)
+{
+    int ret;
+
+    if (krk_uring_available()) {
+        krk_event_set_timer(conn->wev);
+        conn->wev->sock = conn->sock;
+
+        if (krk_uring_connect(conn->wev, addr, addrlen) == KRK_OK) {
+            conn->uring = 1;
+            conn->recv = krk_connection_uring_recv;
+            conn->send = krk_connection_uring_send;
+
+            /* only the timeout part */
+            krk_event_add(conn->wev);
+
+            return KRK_AGAIN;
+        }
+    }
+
+    ret = connect(conn->sock, addr, addrlen);
+    if (ret == 0) {
+        return KRK_OK;
+    }
+
+    if (errno != EINPROGRESS) {
+        return KRK_ERROR;
+    }
+
+    krk_event_set_write(conn->sock, conn->wev);
+    krk_event_add(conn->wev);
+
+    return KRK_AGAIN;
+}
+
+/**
+ * krk_connection_connect_error - outcome of a connect
+ * @conn: connection whose conn->wev got EV_WRITE
+ *
+ * return 0 if connected, the errno of the failure otherwise.
+ */
+int krk_connection_connect_error(struct krk_connection *conn)
+{
+    socklen_t errlen;
+    int err;
+
+    if (conn->uring) {
+        return conn->wev->result < 0 ? -conn->wev->result : 0;
+    }
+
+    errlen = sizeof(err);
+    if (getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0) {
+        return errno;
+    }
+
+    return err;
+}
+
+/**
+ * krk_connection_wait_write - call conn->wev's handler once writable
+ * @conn: connected connection
+ *
+ * a connection fresh from io_uring is writable, its handler 
+ * is called without asking the kernel.
+ */
+void krk_connection_wait_write(struct krk_connection *conn)
+{
+    krk_event_set_write(conn->sock, conn->wev);
+
+    if (conn->uring) {
+        krk_event_active(conn->wev, EV_WRITE);
+        return;
+    }
+
+    krk_event_add(conn->wev);
+}
+
+/**
+ * krk_connection_wait_read - call conn->rev's handler once readable
+ * @conn: connected connection
+ * @buf: where conn->recv is going to be asked to read into
+ * @size: room in buf
+ *
+ * the read stays armed for the whole response, the timeout of 
+ * conn->rev is the deadline of all of it. a handler wanting 
+ * more calls krk_connection_read_more.
+ *
+ * with io_uring, the data is received before the handler is
+ * called, conn->recv then copies it into buf.
+ */
+void krk_connection_wait_read(struct krk_connection *conn, 
+        char *buf, size_t size)
+{
+    if (conn->uring) {
+        krk_event_set_timer(conn->rev);
+        conn->rev->sock = conn->sock;
+
+        if (krk_connection_uring_read(conn, size) == KRK_OK) {
+            krk_event_add(conn->rev);
+            return;
+        }
+
+        /* the ring is full, the rest goes through libevent */
+        conn->uring = 0;
+        conn->recv = krk_connection_recv;
+        conn->send = krk_connection_send;
+    }
+
+    krk_event_set_persist_read(conn->sock, conn->rev);
+    krk_event_add(conn->rev);
+}
+
+/**
+ * krk_connection_read_more - keep reading a response
+ * @conn: connection set up by krk_connection_wait_read
+ * @buf: where the next conn->recv reads into
+ * @size: room in buf
+ *
+ * the deadline is not touched. a persistent read is still 
+ * registered, nothing to do but wait, unless ssl holds data
+ * the socket will not signal.
+ */
+void krk_connection_read_more(struct krk_connection *conn, 
+        char *buf, size_t size)
+{
+    if (!conn->uring) {
+        /* decrypted already, the socket is not going to tell */
+        if (conn->ssl && SSL_pending(conn->ssl->ssl_connection) > 0) {
+            krk_event_active(conn->rev, EV_READ);
+        }
+        return;
+    }
+
+    if (krk_connection_uring_read(conn, size) != KRK_OK) {
+        conn->uring = 0;
+        conn->recv = krk_connection_recv;
+        conn->send = krk_connection_send;
+
+        /* the ring is full, the deadline starts over once */
+        krk_event_set_persist_read(conn->sock, conn->rev);
+        krk_event_add(conn->rev);
+    }
 }
 
 /**
@@ -164,11 +637,14 @@ int krk_connection_exit(void)
 int 
 krk_connection_ssl_init(struct krk_connection *conn, struct krk_ssl *ssl)
 {
-    conn->ssl = krk_ssl_create_connection(conn->sock, ssl);
+    conn->ssl = krk_ssl_create_connection(conn->sock, ssl, &conn->arena);
     if (conn->ssl == NULL) {
         return KRK_ERROR;
     }
 
+    /* ssl is driven by readiness, io_uring only did the connect */
+    conn->uring = 0;
+
     return KRK_OK;
 }
 
@@ -205,7 +681,16 @@ krk_connection_send(struct krk_connection *conn, u_char *buf, size_t size)
 ssize_t 
 krk_connection_ssl_recv(struct krk_connection *conn, u_char *buf, size_t size)
 {
-    return krk_ssl_recv(conn->ssl->ssl_connection, buf, size);
+    ssize_t n;
+
+    n = krk_ssl_recv(conn->ssl->ssl_connection, buf, size);
+    if (n < 0 && SSL_get_error(conn->ssl->ssl_connection, n) 
+            == SSL_ERROR_WANT_READ) {
+        /* only part of a record is in */
+        errno = EAGAIN;
+    }
+
+    return n;
 }
 
 ssize_t 
@@ -19,6 +19,7 @@
 #include <krk_event.h>
 #include <krk_connection.h>
 #include <krk_monitor.h>
+#include <krk_uring.h>
 #include <krk_log.h>
 
 static const struct option optlong[] = {
@@ -33,6 +34,15 @@ static const struct option optlong[] = {
 
 static const char* optstring = "hvrmqs:c:";
 
+/* SIGUSR2, see krk_show_config */
+static struct krk_event *krk_show_ev = NULL;
+
+/* see krk_quit_signal */
+static int krk_quit_signals[] = {SIGINT, SIGQUIT, SIGTERM};
+#define KRK_NR_QUIT_SIGNALS \
+    (sizeof(krk_quit_signals) / sizeof(krk_quit_signals[0]))
+static struct krk_event *krk_quit_ev[KRK_NR_QUIT_SIGNALS];
+
 static void krk_usage(void)
 {
     printf("Usage: krake [option]\n"
@@ -182,6 +192,12 @@ static inline pid_t krk_get_daemon_pid(void)
  */
 static inline int __krk_smooth_quit(void)
 {
+    unsigned int i;
+
+    /* nothing may run on a loop while it is torn down */
+    krk_event_loops_stop();
+    krk_event_loop_switch(krk_event_loop_get(0));
+
     krk_local_socket_exit();
 
     krk_remove_pid_file();
@@ -190,8 +206,22 @@ static inline int __krk_smooth_quit(void)
 
     krk_connection_exit();
 
+    krk_uring_exit();
+
     krk_ssl_exit();
 
+    if (krk_show_ev != NULL) {
+        krk_event_destroy(krk_show_ev);
+        krk_show_ev = NULL;
+    }
+
+    for (i = 0; i < KRK_NR_QUIT_SIGNALS; i++) {
+        if (krk_quit_ev[i] != NULL) {
+            krk_event_destroy(krk_quit_ev[i]);
+            krk_quit_ev[i] = NULL;
+        }
+    }
+
     krk_event_exit();
 
     krk_log_exit();
@@ -282,6 +312,7 @@ static inline void krk_show_monitor_config(char *name)
     char m_name[KRK_NAME_LEN] = {};
     void *buf = NULL;
     void *rcv_buf = NULL;
+    void *new_buf = NULL;
     struct krk_node_info *n_info = NULL;
     int sockfd = 0;
     int buf_size = 0;
@@ -292,13 +323,14 @@ static inline void krk_show_monitor_config(char *name)
 
     if (!strcmp(name, "all")) {
         conf_ret.retval = KRK_CONF_RET_SHOW_ALL_MONITOR; 
-        buf_size = KRK_MONITOR_MAX_NR * KRK_NAME_LEN;
     } else {
         conf_ret.retval = KRK_CONF_RET_SHOW_ONE_MONITOR; 
         strncpy(conf_ret.monitor, name, KRK_NAME_LEN);
-        buf_size = (sizeof(struct krk_monitor_info) + KRK_NODE_MAX_NUM * sizeof(struct krk_node_info));
     }
 
+    /* doubled as the reply comes in, nodes are up to millions */
+    buf_size = LOCAL_SOCK_BUFSZ;
+
     buf = calloc(1, buf_size);
     if (buf == NULL) {
         printf("alloc mem failed!\n");
@@ -318,9 +350,19 @@ static inline void krk_show_monitor_config(char *name)
     }
 
     while (1) {
+        if (buf_len == buf_size) {
+            new_buf = realloc(buf, buf_size * 2);
+            if (new_buf == NULL) {
+                printf("alloc mem failed!\n");
+                goto out;
+            }
+            buf = new_buf;
+            buf_size *= 2;
+        }
+
         rcv_buf = buf + buf_len;
 again:
-        rcv_len = recv(sockfd, rcv_buf, buf_size, 0);
+        rcv_len = recv(sockfd, rcv_buf, buf_size - buf_len, 0);
         if (rcv_len < 0 && errno == EAGAIN) {
             goto again;
         }
@@ -333,7 +375,6 @@ again:
         if (rcv_len == 0) {
             break;
         }
-        buf_size -= rcv_len;
         buf_len += rcv_len;
     }
 
@@ -377,21 +418,75 @@ out:
 }
 
 
-static inline void krk_show_config(int signo)
+/**
+ * SIGUSR2 is taken by libevent on loop 0, the dump runs from
+ * the loop, not from the signal handler: a pause may not nest
+ * into one being started or ended.
+ */
+static void krk_show_config(int signo, short type, void *arg)
 {
+    krk_event_loops_pause();
+    krk_event_show();
+    krk_connection_show();
+    krk_uring_show();
     krk_monitor_show();
+    krk_event_loops_resume();
+}
+
+static int krk_show_init(void)
+{
+    krk_show_ev = krk_event_create(0);
+    if (krk_show_ev == NULL) {
+        return KRK_ERROR;
+    }
+
+    krk_show_ev->handler = krk_show_config;
+    krk_event_set(SIGUSR2, krk_show_ev, EV_SIGNAL | EV_PERSIST);
+
+    return krk_event_add(krk_show_ev) ? KRK_ERROR : KRK_OK;
+}
+
+/**
+ * the quit signals are taken by libevent on loop 0 as well: 
+ * torn down from the signal handler, the daemon deadlocks when
+ * the signal lands while loop 0 holds a libevent lock. the loop
+ * returns instead, and main quits.
+ */
+static void krk_quit_signal(int signo, short type, void *arg)
+{
+    krk_log(KRK_LOG_NOTICE, "caught signal %d\n", signo);
+
+    krk_event_loop_break();
+}
+
+static int krk_quit_init(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < KRK_NR_QUIT_SIGNALS; i++) {
+        krk_quit_ev[i] = krk_event_create(0);
+        if (krk_quit_ev[i] == NULL) {
+            return KRK_ERROR;
+        }
+
+        krk_quit_ev[i]->handler = krk_quit_signal;
+        krk_event_set(krk_quit_signals[i], krk_quit_ev[i], 
+                EV_SIGNAL | EV_PERSIST);
+
+        if (krk_event_add(krk_quit_ev[i])) {
+            return KRK_ERROR;
+        }
+    }
+
+    return KRK_OK;
 }
 
 static inline void krk_signals(void)
 {
-    signal(SIGINT, krk_smooth_quit);	
     signal(SIGKILL, krk_smooth_quit);	
-    signal(SIGQUIT, krk_smooth_quit);	
-    signal(SIGTERM, krk_smooth_quit);	
     signal(SIGSEGV, krk_smooth_quit);
     signal(SIGBUS, krk_smooth_quit);
     signal(SIGCHLD, krk_child_quit);
-    signal(SIGUSR2, krk_show_config);
 }
 
 int main(int argc, char* argv[])
@@ -497,6 +592,18 @@ start:
         return 1;
     }
 
+    if (krk_show_init()) {
+        krk_log(KRK_LOG_ALERT, "Fatal: init show signal failed\n");
+        krk_remove_pid_file();
+        return 1;
+    }
+
+    if (krk_quit_init()) {
+        krk_log(KRK_LOG_ALERT, "Fatal: init quit signals failed\n");
+        krk_remove_pid_file();
+        return 1;
+    }
+
     if (krk_ssl_init()) {
         krk_log(KRK_LOG_ALERT, "Fatal: init ssl failed\n");
         krk_remove_pid_file();
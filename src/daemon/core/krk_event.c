@@ -10,6 +10,9 @@
  * (at your option) any later version.
  */
 
+#include <signal.h>
+#include <event2/thread.h>
+
 #include <krk_core.h>
 #include <krk_event.h>
 #include <krk_buffer.h>
@@ -18,16 +21,406 @@
 int krk_event_init(void);
 void krk_event_loop(void);
 int krk_event_add(struct krk_event *event);
+int krk_event_add_at(struct krk_event *event, unsigned long long usec);
 int krk_event_del(struct krk_event *event);
+void krk_event_active(struct krk_event *event, short type);
 struct krk_event* krk_event_create(size_t bufsz);
 int krk_event_destroy(struct krk_event* event);
 void krk_event_set(int sock, struct krk_event *event, short type);
 void krk_event_set_timer(struct krk_event *tmout);
+void krk_event_set_timeout(struct krk_event *event, unsigned long usec);
+void krk_event_reset(struct krk_event *event);
 void krk_event_set_read(int sock, struct krk_event *event);
 void krk_event_set_write(int sock, struct krk_event *event);
+void krk_event_set_persist_read(int sock, struct krk_event *event);
+void krk_timer_init(struct krk_timer *timer, timer_handler handler, void *data);
+void krk_timer_add(struct krk_timer *timer, const struct timeval *tv);
+void krk_timer_del(struct krk_timer *timer);
+void krk_timer_add_at(struct krk_timer *timer, unsigned long long usec);
+unsigned long long krk_time_usec(void);
+int krk_event_loops_start(unsigned int nr_workers);
+void krk_event_loops_stop(void);
+void krk_event_loops_pause(void);
+void krk_event_loops_resume(void);
+unsigned int krk_event_loop_nr_workers(void);
+struct krk_event_loop* krk_event_loop_get(unsigned int id);
+struct krk_event_loop* krk_event_loop_pick(const char *key);
+struct krk_event_loop* krk_event_loop_switch(struct krk_event_loop *loop);
+void krk_event_set_lag_threshold(unsigned long usec);
+int krk_event_loop_overloaded(void);
+void krk_event_show(void);
+
+static void krk_event_lag_sample(struct krk_event_loop *loop, unsigned long tick);
+
+static struct krk_event_loop krk_event_loops[KRK_EVENT_LOOP_MAX];
+static unsigned int krk_nr_workers = 0;
+static unsigned int krk_workers_started = 0;
+static unsigned int krk_workers_paused = 0;
+
+/* lag a loop is overloaded at, in usec, 0 never */
+static unsigned long krk_lag_threshold = 0;
+
+/* stop-the-world: workers meet the coordinator here */
+static pthread_barrier_t krk_pause_barrier;
+static pthread_barrier_t krk_resume_barrier;
+
+__thread struct krk_event_loop *krk_current_loop = NULL;
+
+/* everything below works on the loop of the calling thread */
+#define krk_event_base (krk_current_loop->base)
+#define krk_wheel (krk_current_loop->wheel)
+
+static unsigned long krk_timer_tick(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * (1000000 / KRK_TIMER_TICK_USEC) 
+        + ts.tv_nsec / (KRK_TIMER_TICK_USEC * 1000);
+}
+
+/* the longest delay the last level can hold */
+#define KRK_TIMER_WHEEL_MAX_DELTA \
+    ((1UL << (KRK_TIMER_WHEEL_BITS * (KRK_TIMER_WHEEL_LEVELS - 1))) \
+     * KRK_TIMER_WHEEL_SIZE - 1)
+
+/**
+ * krk_timer_link - put a timer into the slot matching its expiry
+ * @timer: timer to link, timer->expires must be set
+ *
+ * level l holds the timers which expire within
+ * 256^(l+1) ticks from now, timers beyond the last
+ * level are clamped into it and re-cascaded later.
+ */
+static void krk_timer_link(struct krk_timer *timer)
+{
+    unsigned long delta, expires;
+    int level, shift;
+
+    expires = timer->expires;
+    if ((long)(expires - krk_wheel.now) < 0) {
+        expires = krk_wheel.now;
+    }
+
+    delta = expires - krk_wheel.now;
+    if (delta > KRK_TIMER_WHEEL_MAX_DELTA) {
+        delta = KRK_TIMER_WHEEL_MAX_DELTA;
+        expires = krk_wheel.now + delta;
+    }
+
+    for (level = 0; level < KRK_TIMER_WHEEL_LEVELS - 1; level++) {
+        if ((delta >> (KRK_TIMER_WHEEL_BITS * (level + 1))) == 0) {
+            break;
+        }
+    }
+
+    shift = KRK_TIMER_WHEEL_BITS * level;
+    list_add_tail(&timer->list, 
+            &krk_wheel.slots[level][(expires >> shift) & KRK_TIMER_WHEEL_MASK]);
+    krk_wheel.nr_timers[level]++;
+
+    timer->level = level;
+    timer->pending = 1;
+}
+
+/**
+ * krk_timer_arm - arm the backing libevent timer
+ * @tick: tick the wheel wants to be processed at
+ *
+ */
+static void krk_timer_arm(unsigned long tick)
+{
+    struct timeval tv;
+    unsigned long now, usec;
+
+    now = krk_timer_tick();
+    usec = (long)(tick - now) > 0 ? (tick - now) * KRK_TIMER_TICK_USEC : 0;
+
+    tv.tv_sec = usec / 1000000;
+    tv.tv_usec = usec % 1000000;
+
+    evtimer_add(krk_wheel.ev, &tv);
+
+    krk_wheel.next = tick;
+    krk_wheel.armed = 1;
+}
+
+/**
+ * krk_timer_rearm - arm the backing timer for the next busy tick
+ * @
+ *
+ * the nearest busy slot of level 0 is searched, if the
+ * other levels have timers, we have to wake up at the 
+ * next cascading point at the latest.
+ */
+static void krk_timer_rearm(void)
+{
+    unsigned long tick, next = 0;
+    int i, level, found = 0;
+
+    for (i = 1; i < KRK_TIMER_WHEEL_SIZE; i++) {
+        tick = krk_wheel.now + i;
+        if ((tick & KRK_TIMER_WHEEL_MASK) == 0) {
+            break;
+        }
+
+        if (!list_empty(&krk_wheel.slots[0][tick & KRK_TIMER_WHEEL_MASK])) {
+            next = tick;
+            found = 1;
+            break;
+        }
+    }
+
+    if (!found) {
+        for (level = 0; level < KRK_TIMER_WHEEL_LEVELS; level++) {
+            if (krk_wheel.nr_timers[level]) {
+                next = (krk_wheel.now | KRK_TIMER_WHEEL_MASK) + 1;
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    if (!found) {
+        evtimer_del(krk_wheel.ev);
+        krk_wheel.armed = 0;
+        return;
+    }
+
+    krk_timer_arm(next);
+}
+
+static void krk_timer_cascade(int level)
+{
+    struct list_head list, *head;
+    struct krk_timer *timer;
+    int idx;
+
+    idx = (krk_wheel.now >> (KRK_TIMER_WHEEL_BITS * level)) & KRK_TIMER_WHEEL_MASK;
+    head = &krk_wheel.slots[level][idx];
 
-/* the global event_base */
-static struct event_base *krk_event_base = NULL;
+    INIT_LIST_HEAD(&list);
+    list_splice_init(head, &list);
+
+    while (!list_empty(&list)) {
+        timer = list_first_entry(&list, struct krk_timer, list);
+        list_del_init(&timer->list);
+        krk_wheel.nr_timers[level]--;
+
+        krk_timer_link(timer);
+    }
+}
+
+/**
+ * krk_timer_expire - walk the wheel up to current tick
+ * @
+ *
+ * called by the backing libevent timer.
+ */
+static void krk_timer_expire(int sock, short type, void *arg)
+{
+    struct list_head list;
+    struct krk_timer *timer;
+    unsigned long now;
+    int level;
+
+    now = krk_timer_tick();
+
+    if (krk_wheel.armed) {
+        krk_event_lag_sample(krk_current_loop, krk_wheel.next);
+    }
+
+    krk_wheel.armed = 0;
+
+    while ((long)(now - krk_wheel.now) > 0) {
+        krk_wheel.now++;
+
+        for (level = 1; level < KRK_TIMER_WHEEL_LEVELS; level++) {
+            if ((krk_wheel.now 
+                        & ((1UL << (KRK_TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            krk_timer_cascade(level);
+        }
+
+        INIT_LIST_HEAD(&list);
+        list_splice_init(&krk_wheel.slots[0][krk_wheel.now & KRK_TIMER_WHEEL_MASK], 
+                &list);
+
+        while (!list_empty(&list)) {
+            timer = list_first_entry(&list, struct krk_timer, list);
+            list_del_init(&timer->list);
+            krk_wheel.nr_timers[0]--;
+            timer->pending = 0;
+
+            /* the handler may add or delete any timer, incl. this one */
+            timer->handler(timer);
+        }
+    }
+
+    krk_timer_rearm();
+}
+
+void krk_timer_init(struct krk_timer *timer, timer_handler handler, void *data)
+{
+    INIT_LIST_HEAD(&timer->list);
+    timer->expires = 0;
+    timer->handler = handler;
+    timer->data = data;
+    timer->pending = 0;
+}
+
+static void krk_timer_schedule(struct krk_timer *timer, unsigned long expires)
+{
+    krk_timer_del(timer);
+
+    timer->expires = expires;
+
+    krk_timer_link(timer);
+
+    if (!krk_wheel.armed || (long)(timer->expires - krk_wheel.next) < 0) {
+        krk_timer_arm(timer->expires);
+    }
+}
+
+/**
+ * krk_timer_add - (re)schedule a timer
+ * @timer: timer to schedule
+ * @tv: relative timeout
+ *
+ * O(1), a pending timer is moved to its new slot.
+ */
+void krk_timer_add(struct krk_timer *timer, const struct timeval *tv)
+{
+    unsigned long ticks;
+
+    ticks = (tv->tv_sec * 1000000UL + tv->tv_usec 
+            + KRK_TIMER_TICK_USEC - 1) / KRK_TIMER_TICK_USEC;
+    if (ticks == 0) {
+        /* the slot of current tick may be processed already */
+        ticks = 1;
+    }
+
+    krk_timer_schedule(timer, krk_timer_tick() + ticks);
+}
+
+/**
+ * krk_timer_add_at - (re)schedule a timer at an absolute time
+ * @timer: timer to schedule
+ * @usec: deadline on the monotonic clock, see krk_time_usec
+ *
+ * periodic users should advance their own deadline and use
+ * this one, so the time spent in handlers does not add up.
+ * a deadline in the past fires on the next tick.
+ */
+void krk_timer_add_at(struct krk_timer *timer, unsigned long long usec)
+{
+    unsigned long expires, now;
+
+    expires = (usec + KRK_TIMER_TICK_USEC - 1) / KRK_TIMER_TICK_USEC;
+
+    now = krk_timer_tick();
+    if ((long)(expires - now) <= 0) {
+        expires = now + 1;
+    }
+
+    krk_timer_schedule(timer, expires);
+}
+
+/**
+ * krk_time_usec - current time of the monotonic clock
+ * @
+ *
+ * return microseconds, the same clock the wheel runs on.
+ */
+unsigned long long krk_time_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * krk_timer_del - cancel a timer
+ * @timer: timer to cancel
+ *
+ * O(1), nothing happens if the timer is not pending.
+ */
+void krk_timer_del(struct krk_timer *timer)
+{
+    if (!timer->pending) {
+        return;
+    }
+
+    list_del_init(&timer->list);
+    krk_wheel.nr_timers[timer->level]--;
+
+    timer->pending = 0;
+}
+
+static int krk_timer_wheel_init(void)
+{
+    int level, i;
+
+    for (level = 0; level < KRK_TIMER_WHEEL_LEVELS; level++) {
+        for (i = 0; i < KRK_TIMER_WHEEL_SIZE; i++) {
+            INIT_LIST_HEAD(&krk_wheel.slots[level][i]);
+        }
+        krk_wheel.nr_timers[level] = 0;
+    }
+
+    krk_wheel.now = krk_timer_tick();
+    krk_wheel.armed = 0;
+
+    krk_wheel.ev = evtimer_new(krk_event_base, krk_timer_expire, NULL);
+    if (krk_wheel.ev == NULL) {
+        return KRK_ERROR;
+    }
+
+    return KRK_OK;
+}
+
+/**
+ * krk_event_timeout - deadline of an event expired
+ * @timer: timer embedded in the event
+ *
+ */
+static void krk_event_timeout(struct krk_timer *timer)
+{
+    struct krk_event *event;
+
+    event = timer->data;
+
+    if (event->ev) {
+        event_del(event->ev);
+    }
+
+    event->handler(event->sock, EV_TIMEOUT, event);
+}
+
+/**
+ * krk_event_dispatch - io of an event is ready
+ * @
+ *
+ * cancel the deadline in the wheel, then call the real handler.
+ * a persistent event stays registered, its deadline keeps running
+ * until the event is deleted, it covers the whole exchange.
+ */
+static void krk_event_dispatch(int sock, short type, void *arg)
+{
+    struct krk_event *event;
+
+    event = arg;
+
+    if (!(event_get_events(&event->io) & EV_PERSIST)) {
+        krk_timer_del(&event->timer);
+    }
+
+    event->handler(sock, type, event);
+}
 
 /**
  * krk_event_create - create a new event
@@ -47,6 +440,9 @@ struct krk_event* krk_event_create(size_t bufsz)
 
     memset(event, 0, sizeof(struct krk_event));
 
+    krk_timer_init(&event->timer, krk_event_timeout, event);
+    event->sock = -1;
+
     event->buf = krk_buffer_create(bufsz);
     if (!event->buf) {
         free(event);
@@ -71,11 +467,13 @@ int krk_event_destroy(struct krk_event* event)
         return -1;
     }
 
+    krk_timer_del(&event->timer);
+
     if (event->ev) {
-        event_free(event->ev);
+        event_del(event->ev);
     }
 
-    if (event->timeout) {
+    if (event->timeout && event->timeout != &event->tv) {
         free(event->timeout);
     }
 
@@ -89,19 +487,143 @@ int krk_event_destroy(struct krk_event* event)
     return 0;
 }
 
+/**
+ * krk_event_lag_sample - measure how late a loop runs its wheel
+ * @loop: loop to measure
+ * @tick: tick the wheel was due at
+ *
+ * a loop turns overloaded when the lag goes over the threshold,
+ * and recovers once it has stayed under half of it for a whole
+ * KRK_EVENT_LAG_INTERVAL, so it does not flap around the
+ * threshold. it is sampled before any
+ * timer runs, so a timeout that is late because of the lag
+ * already sees the loop overloaded.
+ */
+static void krk_event_lag_sample(struct krk_event_loop *loop, unsigned long tick)
+{
+    unsigned long long now, due;
+    unsigned long lag;
+
+    now = krk_time_usec();
+    due = (unsigned long long)tick * KRK_TIMER_TICK_USEC;
+    lag = now > due ? now - due : 0;
+
+    loop->lag_last = lag;
+    if (lag > loop->lag_max) {
+        loop->lag_max = lag;
+    }
+    loop->lag_sum += lag;
+    loop->nr_lag++;
+
+    if (krk_lag_threshold == 0) {
+        loop->overloaded = 0;
+        return;
+    }
+
+    if (lag >= krk_lag_threshold / 2) {
+        loop->lag_high_at = now;
+    }
+
+    if (!loop->overloaded && lag > krk_lag_threshold) {
+        loop->overloaded = 1;
+        loop->nr_overload++;
+        krk_log(KRK_LOG_NOTICE, "loop %u overloaded, lag %lu usec\n", 
+                loop->id, lag);
+    } else if (loop->overloaded 
+            && now - loop->lag_high_at >= KRK_EVENT_LAG_INTERVAL) {
+        loop->overloaded = 0;
+        krk_log(KRK_LOG_NOTICE, "loop %u recovered, lag %lu usec\n", 
+                loop->id, lag);
+    }
+}
+
+/**
+ * krk_event_lag_handler - keep the wheel of an idle loop turning
+ * @timer: lag_timer of the loop
+ *
+ * the lag is sampled each time the wheel runs, this timer
+ * makes sure that is at least every KRK_EVENT_LAG_INTERVAL.
+ */
+static void krk_event_lag_handler(struct krk_timer *timer)
+{
+    struct timeval tv;
+
+    tv.tv_sec = KRK_EVENT_LAG_INTERVAL / 1000000;
+    tv.tv_usec = KRK_EVENT_LAG_INTERVAL % 1000000;
+
+    krk_timer_add(timer, &tv);
+}
+
+static int krk_event_loop_init(struct krk_event_loop *loop, unsigned int id)
+{
+    struct krk_event_loop *saved;
+    int ret;
+
+    loop->id = id;
+
+    loop->base = event_base_new();
+    if (loop->base == NULL) {
+        return KRK_ERROR;
+    }
+
+    saved = krk_event_loop_switch(loop);
+
+    ret = krk_timer_wheel_init();
+    if (ret == KRK_OK) {
+        krk_timer_init(&loop->lag_timer, krk_event_lag_handler, loop);
+        krk_event_lag_handler(&loop->lag_timer);
+    }
+
+    krk_event_loop_switch(saved);
+
+    if (ret != KRK_OK) {
+        event_base_free(loop->base);
+        loop->base = NULL;
+    }
+
+    return ret;
+}
+
+static void krk_event_loop_free(struct krk_event_loop *loop)
+{
+    if (loop->pause_ev) {
+        event_free(loop->pause_ev);
+        loop->pause_ev = NULL;
+    }
+
+    if (loop->wheel.ev) {
+        event_free(loop->wheel.ev);
+        loop->wheel.ev = NULL;
+    }
+
+    if (loop->base) {
+        event_base_free(loop->base);
+        loop->base = NULL;
+    }
+}
+
 /**
  * krk_event_init - init events
  * @
  *
+ * the calling thread becomes the coordinator, loop 0.
+ *
  * return 0 on success
  */
 int krk_event_init(void)
 {
-    krk_event_base = event_base_new();
-    if (krk_event_base == NULL) {
+    /* workers and the coordinator touch each other's bases */
+    if (evthread_use_pthreads() < 0) {
         return KRK_ERROR;
     }
 
+    if (krk_event_loop_init(&krk_event_loops[0], 0) != KRK_OK) {
+        return KRK_ERROR;
+    }
+
+    krk_current_loop = &krk_event_loops[0];
+    krk_event_loops[0].running = 1;
+
     return KRK_OK;
 }
 
@@ -109,49 +631,421 @@ int krk_event_init(void)
  * krk_event_exit - exit events
  * @
  *
+ * the workers must have been stopped.
+ *
  * return 0 on success
  */
 int krk_event_exit(void)
 {
-    event_base_free(krk_event_base);
+    unsigned int i;
+
+    for (i = 0; i <= krk_nr_workers; i++) {
+        krk_event_loop_free(&krk_event_loops[i]);
+    }
 
     return KRK_OK;
 }
 
+static void krk_event_loop_pause_handler(int sock, short type, void *arg)
+{
+    pthread_barrier_wait(&krk_pause_barrier);
+    pthread_barrier_wait(&krk_resume_barrier);
+}
+
+static void* krk_event_loop_run(void *arg)
+{
+    struct krk_event_loop *loop = arg;
+
+    krk_current_loop = loop;
+
+    event_base_loop(loop->base, EVLOOP_NO_EXIT_ON_EMPTY);
+
+    return NULL;
+}
+
+/**
+ * krk_event_loops_start - start the worker threads
+ * @nr_workers: number of workers, 0 runs everything on the coordinator
+ *
+ * the number of workers is fixed once started, a different 
+ * value is ignored until restart. signals are blocked in the
+ * workers, they are all handled by the coordinator.
+ *
+ * return KRK_OK on success;
+ * KRK_ERROR for failed.
+ */
+int krk_event_loops_start(unsigned int nr_workers)
+{
+    sigset_t all, old;
+    unsigned int i;
+
+    if (krk_workers_started) {
+        if (nr_workers != krk_nr_workers) {
+            krk_log(KRK_LOG_NOTICE, "workers %u -> %u takes effect after restart\n",
+                    krk_nr_workers, nr_workers);
+        }
+        return KRK_OK;
+    }
+
+    if (nr_workers > KRK_EVENT_LOOP_MAX_WORKERS) {
+        return KRK_ERROR;
+    }
+
+    krk_workers_started = 1;
+
+    if (nr_workers == 0) {
+        return KRK_OK;
+    }
+
+    for (i = 1; i <= nr_workers; i++) {
+        if (krk_event_loop_init(&krk_event_loops[i], i) != KRK_OK) {
+            goto failed;
+        }
+
+        krk_event_loops[i].pause_ev = event_new(krk_event_loops[i].base, -1, 0, 
+                krk_event_loop_pause_handler, NULL);
+        if (krk_event_loops[i].pause_ev == NULL) {
+            goto failed;
+        }
+    }
+
+    pthread_barrier_init(&krk_pause_barrier, NULL, nr_workers + 1);
+    pthread_barrier_init(&krk_resume_barrier, NULL, nr_workers + 1);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for (i = 1; i <= nr_workers; i++) {
+        if (pthread_create(&krk_event_loops[i].thread, NULL, 
+                    krk_event_loop_run, &krk_event_loops[i])) {
+            krk_log(KRK_LOG_ALERT, "start worker %u failed\n", i);
+            break;
+        }
+        krk_event_loops[i].running = 1;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    krk_nr_workers = nr_workers;
+
+    if (i <= nr_workers) {
+        krk_event_loops_stop();
+        return KRK_ERROR;
+    }
+
+    krk_log(KRK_LOG_NOTICE, "%u workers started\n", nr_workers);
+
+    return KRK_OK;
+
+failed:
+    for (; i > 0; i--) {
+        krk_event_loop_free(&krk_event_loops[i]);
+    }
+
+    return KRK_ERROR;
+}
+
+static int krk_event_loops_running(void)
+{
+    return krk_nr_workers && krk_event_loops[1].running;
+}
+
+/**
+ * krk_event_loops_stop - stop and join the worker threads
+ * @
+ *
+ * the loops are kept until krk_event_exit, so their monitors
+ * and connections can still be torn down.
+ */
+void krk_event_loops_stop(void)
+{
+    unsigned int i;
+
+    /**
+     * pauses nest, and only the resume matching the outermost 
+     * pause lets the workers go. stop is called outside of any
+     * pause, unless the daemon quits from within one, then each
+     * pause still open is undone by its own resume, or the workers
+     * would stay parked forever.
+     */
+    while (krk_workers_paused && krk_event_loops_running()) {
+        krk_event_loops_resume();
+    }
+
+    for (i = 1; i <= krk_nr_workers; i++) {
+        if (krk_event_loops[i].running) {
+            event_base_loopbreak(krk_event_loops[i].base);
+        }
+    }
+
+    for (i = 1; i <= krk_nr_workers; i++) {
+        if (krk_event_loops[i].running) {
+            pthread_join(krk_event_loops[i].thread, NULL);
+            krk_event_loops[i].running = 0;
+        }
+    }
+}
+
+/**
+ * krk_event_loops_pause - stop the world
+ * @
+ *
+ * returns once all the workers are parked, after that the 
+ * coordinator may touch anything owned by a worker, after
+ * switching to its loop. calls nest.
+ */
+void krk_event_loops_pause(void)
+{
+    unsigned int i;
+
+    if (!krk_event_loops_running() || krk_workers_paused++) {
+        return;
+    }
+
+    for (i = 1; i <= krk_nr_workers; i++) {
+        event_active(krk_event_loops[i].pause_ev, EV_READ, 0);
+    }
+
+    pthread_barrier_wait(&krk_pause_barrier);
+}
+
+void krk_event_loops_resume(void)
+{
+    if (!krk_event_loops_running() || --krk_workers_paused) {
+        return;
+    }
+
+    pthread_barrier_wait(&krk_resume_barrier);
+}
+
+unsigned int krk_event_loop_nr_workers(void)
+{
+    return krk_nr_workers;
+}
+
+struct krk_event_loop* krk_event_loop_get(unsigned int id)
+{
+    return &krk_event_loops[id];
+}
+
+/**
+ * krk_event_loop_pick - the loop a key is sharded to
+ * @key: name of the object to place
+ *
+ * FNV-1a of the key over the workers, the coordinator
+ * when there is no worker.
+ */
+struct krk_event_loop* krk_event_loop_pick(const char *key)
+{
+    unsigned int hash = 2166136261U;
+
+    if (krk_nr_workers == 0) {
+        return &krk_event_loops[0];
+    }
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619U;
+    }
+
+    return &krk_event_loops[1 + hash % krk_nr_workers];
+}
+
+/**
+ * krk_event_loop_switch - make the calling thread work on a loop
+ * @loop: loop to switch to
+ *
+ * only the coordinator switches, with the world stopped.
+ *
+ * return the previous loop.
+ */
+struct krk_event_loop* krk_event_loop_switch(struct krk_event_loop *loop)
+{
+    struct krk_event_loop *saved;
+
+    saved = krk_current_loop;
+    krk_current_loop = loop;
+
+    return saved;
+}
+
+/**
+ * krk_event_add - arm an event
+ * @event: event to arm
+ *
+ * the io part goes to libevent, the timeout part
+ * goes to the timing wheel.
+ */
 int krk_event_add(struct krk_event *event)
 {
-    return event_add(event->ev, event->timeout);
+    if (event->timeout) {
+        krk_timer_add(&event->timer, event->timeout);
+    }
+
+    if (event->ev) {
+        return event_add(event->ev, NULL);
+    }
+
+    return 0;
+}
+
+/**
+ * krk_event_add_at - arm a timer event at an absolute time
+ * @event: event to arm, a pure timer
+ * @usec: deadline on the monotonic clock, see krk_time_usec
+ *
+ */
+int krk_event_add_at(struct krk_event *event, unsigned long long usec)
+{
+    krk_timer_add_at(&event->timer, usec);
+
+    return 0;
 }
 
 int krk_event_del(struct krk_event *event)
 {
-    return event_del(event->ev);
+    krk_timer_del(&event->timer);
+
+    if (event->ev) {
+        return event_del(event->ev);
+    }
+
+    return 0;
 }
 
-void krk_event_set(int sock, struct krk_event *event, short type)
+/**
+ * krk_event_set_lag_threshold - set the lag a loop is overloaded at
+ * @usec: threshold in usec, 0 only measures
+ *
+ * the workers must be paused.
+ */
+void krk_event_set_lag_threshold(unsigned long usec)
+{
+    krk_lag_threshold = usec;
+}
+
+/**
+ * krk_event_loop_overloaded - is the calling thread's loop overloaded
+ * @
+ *
+ * return 1 if the loop lags behind, 0 otherwise.
+ */
+int krk_event_loop_overloaded(void)
+{
+    return krk_current_loop->overloaded;
+}
+
+void krk_event_show(void)
+{
+    struct krk_event_loop *loop;
+    unsigned int i;
+
+    for (i = 0; i <= krk_nr_workers; i++) {
+        loop = &krk_event_loops[i];
+
+        fprintf(stderr,"loop %u: lag = %luus, avg = %luus, max = %luus, "
+                "overloaded = %u (%lu times)\n",
+                i, loop->lag_last, 
+                loop->nr_lag ? (unsigned long)(loop->lag_sum / loop->nr_lag) : 0,
+                loop->lag_max, loop->overloaded, loop->nr_overload);
+    }
+}
+
+/**
+ * krk_event_active - run the handler of an event soon
+ * @event: event with an io part, added or not
+ * @type: passed to the handler
+ *
+ * the handler runs from the loop, after the current one returns.
+ */
+void krk_event_active(struct krk_event *event, short type)
 {
-    /* set here means delete the old one and assign a new one */
     if (event->ev) {
-        event_free(event->ev);
+        event_active(event->ev, type, 0);
     }
+}
 
-    event->ev = event_new(krk_event_base, sock, type, event->handler, (void*)event);
-    if (event->ev == NULL) {
-        krk_log(KRK_LOG_DEBUG, "ev-%p: event_new failed in %s\n", event, __func__);
-        /* FIXME: do some thing here */
+/**
+ * krk_event_set - (re)target the io part of an event
+ * @sock: socket to watch
+ * @event: event to set
+ * @type: EV_READ or EV_WRITE, optionally with EV_PERSIST
+ *
+ * the libevent storage is embedded in the krk_event, switching
+ * between read and write costs no allocation.
+ */
+void krk_event_set(int sock, struct krk_event *event, short type)
+{
+    /* event_assign must not be used on a pending event */
+    if (event->ev) {
+        event_del(event->ev);
     }
+
+    event->sock = sock;
+    event_assign(&event->io, krk_event_base, sock, type, 
+            krk_event_dispatch, (void*)event);
+    event->ev = &event->io;
 }
 
+/**
+ * krk_event_set_timer - turn an event into a pure timer
+ * @tmout: event to set
+ *
+ * pure timers have no libevent part, they live in the wheel only.
+ */
 void krk_event_set_timer(struct krk_event *tmout)
 {
     if (tmout->ev) {
-        event_free(tmout->ev);
+        event_del(tmout->ev);
+        tmout->ev = NULL;
+    }
+
+    krk_timer_del(&tmout->timer);
+    tmout->sock = -1;
+}
+
+/**
+ * krk_event_set_timeout - set the timeout of an event
+ * @event: event to set
+ * @usec: timeout in usec, relative to krk_event_add
+ *
+ * the timeval lives in the event itself, nothing is allocated.
+ */
+void krk_event_set_timeout(struct krk_event *event, unsigned long usec)
+{
+    if (event->timeout && event->timeout != &event->tv) {
+        free(event->timeout);
     }
 
-    tmout->ev = evtimer_new(krk_event_base, tmout->handler, (void*)tmout);
-    if (tmout->ev == NULL) {
-        krk_log(KRK_LOG_DEBUG, "ev-%p: event_new failed in %s\n", tmout, __func__);
-        /* FIXME: do some thing here */
+    event->tv.tv_sec = usec / 1000000;
+    event->tv.tv_usec = usec % 1000000;
+    event->timeout = &event->tv;
+}
+
+/**
+ * krk_event_reset - bring an event back to the state of krk_event_create
+ * @event: event to reset
+ *
+ * used by pools to recycle an event, the buffer is kept
+ * but emptied, event->conn is kept.
+ */
+void krk_event_reset(struct krk_event *event)
+{
+    krk_event_del(event);
+    event->ev = NULL;
+
+    if (event->timeout && event->timeout != &event->tv) {
+        free(event->timeout);
+    }
+    event->timeout = NULL;
+
+    event->handler = NULL;
+    event->data = NULL;
+    event->sock = -1;
+    event->result = 0;
+
+    if (event->buf) {
+        event->buf->pos = event->buf->last = event->buf->head;
     }
 }
 
@@ -165,9 +1059,34 @@ void krk_event_set_write(int sock, struct krk_event *event)
     krk_event_set(sock, event, EV_WRITE);
 }
 
+/**
+ * krk_event_set_persist_read - watch a socket until told otherwise
+ * @sock: socket to watch
+ * @event: event to set
+ *
+ * the handler is called on every readable socket without the event
+ * being added again. the timeout set on the event is a deadline for
+ * all of them, counted from krk_event_add.
+ */
+void krk_event_set_persist_read(int sock, struct krk_event *event)
+{
+    krk_event_set(sock, event, EV_READ | EV_PERSIST);
+}
+
 void krk_event_loop(void)
 {
-    /* FIXME: use EVLOOP_NO_EXIT_ON_EMPTY as the flag in higher version libevent */
-    event_base_loop(krk_event_base, 0);
+    event_base_loop(krk_event_loops[0].base, EVLOOP_NO_EXIT_ON_EMPTY);
+}
+
+/**
+ * krk_event_loop_break - make krk_event_loop return
+ * @
+ *
+ * called on loop 0, the loop returns once the current
+ * handler is done.
+ */
+void krk_event_loop_break(void)
+{
+    event_base_loopbreak(krk_event_loops[0].base);
 }
 
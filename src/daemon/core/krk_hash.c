@@ -0,0 +1,154 @@
+/**
+ * krk_hash.c - Krake hash index
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <krk_core.h>
+#include <krk_hash.h>
+
+int krk_hash_init(struct krk_hash *table, unsigned long size);
+void krk_hash_destroy(struct krk_hash *table);
+void krk_hash_add(struct krk_hash *table, 
+        struct krk_hash_link *link, unsigned int hash);
+void krk_hash_del(struct krk_hash *table, struct krk_hash_link *link);
+unsigned int krk_hash_fnv(const void *data, size_t len, unsigned int hash);
+
+static struct list_head* krk_hash_alloc_buckets(unsigned long size)
+{
+    struct list_head *buckets;
+    unsigned long i;
+
+    buckets = malloc(size * sizeof(struct list_head));
+    if (buckets == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++) {
+        INIT_LIST_HEAD(&buckets[i]);
+    }
+
+    return buckets;
+}
+
+/**
+ * krk_hash_init - init an empty table
+ * @table: table to init
+ * @size: initial number of buckets, rounded up to a power of 2
+ *
+ * return KRK_OK for success;
+ * KRK_ERROR for failed.
+ */
+int krk_hash_init(struct krk_hash *table, unsigned long size)
+{
+    unsigned long n;
+
+    for (n = KRK_HASH_MIN_SIZE; n < size; n <<= 1) {
+        /* void */
+    }
+
+    table->buckets = krk_hash_alloc_buckets(n);
+    if (table->buckets == NULL) {
+        return KRK_ERROR;
+    }
+
+    table->size = n;
+    table->nr = 0;
+
+    return KRK_OK;
+}
+
+/**
+ * krk_hash_destroy - free the buckets of a table
+ * @table: table to destroy
+ *
+ * the objects are not touched.
+ */
+void krk_hash_destroy(struct krk_hash *table)
+{
+    free(table->buckets);
+
+    table->buckets = NULL;
+    table->size = 0;
+    table->nr = 0;
+}
+
+/**
+ * krk_hash_grow - double the buckets of a table
+ * @table: table to grow
+ *
+ * a failed allocation keeps the table as it is, only the
+ * chains get longer.
+ */
+static void krk_hash_grow(struct krk_hash *table)
+{
+    struct list_head *old, *buckets;
+    struct krk_hash_link *link;
+    unsigned long i, size;
+
+    size = table->size << 1;
+
+    buckets = krk_hash_alloc_buckets(size);
+    if (buckets == NULL) {
+        return;
+    }
+
+    old = table->buckets;
+    table->buckets = buckets;
+
+    for (i = 0; i < table->size; i++) {
+        while (!list_empty(&old[i])) {
+            link = list_first_entry(&old[i], struct krk_hash_link, list);
+            list_del(&link->list);
+            list_add_tail(&link->list, &buckets[link->hash & (size - 1)]);
+        }
+    }
+
+    table->size = size;
+
+    free(old);
+}
+
+void krk_hash_add(struct krk_hash *table, 
+        struct krk_hash_link *link, unsigned int hash)
+{
+    link->hash = hash;
+    list_add_tail(&link->list, krk_hash_bucket(table, hash));
+
+    table->nr++;
+    if (table->nr > table->size * 2) {
+        krk_hash_grow(table);
+    }
+}
+
+void krk_hash_del(struct krk_hash *table, struct krk_hash_link *link)
+{
+    list_del_init(&link->list);
+    table->nr--;
+}
+
+/**
+ * krk_hash_fnv - FNV-1a over a buffer
+ * @data: bytes to hash
+ * @len: number of bytes
+ * @hash: KRK_HASH_FNV_INIT, or the result over the previous part of a key
+ *
+ */
+unsigned int krk_hash_fnv(const void *data, size_t len, unsigned int hash)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
@@ -125,6 +125,7 @@ void krk_log(int prio, const char *fmt, ...)
 {
     va_list arg_ptr;
     char new_fmt[KRK_MAX_LOG_SIZE];
+    char now[32];
     time_t t;
 
     if (prio > log_level) {
@@ -136,7 +137,7 @@ void krk_log(int prio, const char *fmt, ...)
     if (log_type & LOG_TYPE_FILE) {
         va_start(arg_ptr, fmt);
         snprintf(new_fmt, KRK_MAX_LOG_SIZE, filelog_format, 
-                weed(ctime(&t)), krk_prio[prio], fmt);
+                weed(ctime_r(&t, now)), krk_prio[prio], fmt);
 
         vfprintf(log_fp, new_fmt, arg_ptr);
         fflush(log_fp);
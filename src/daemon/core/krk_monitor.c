@@ -14,6 +14,7 @@
 #include <krk_monitor.h>
 #include <checkers/krk_checker.h>
 #include <krk_log.h>
+#include <krk_ring.h>
 
 struct krk_monitor* krk_monitor_find(const char *name);
 struct krk_monitor* krk_monitor_create(const char *name);
@@ -42,9 +43,68 @@ int krk_monitor_remove_node_connection(struct krk_node *node, struct krk_connect
 void krk_monitor_destroy_ssl(struct krk_monitor *monitor);
 
 LIST_HEAD(krk_all_monitors);
+static struct krk_hash krk_monitor_index;   /* monitors by name */
 unsigned int krk_max_monitors = 0;
 unsigned int krk_nr_monitors = 0;
-unsigned short krk_nr_nodes = 0;
+unsigned int krk_max_nodes = 0;
+unsigned int krk_nr_nodes = 0;
+static unsigned int krk_monitor_next_id = 0;
+
+/**
+ * node handle table, a node's handle is the index of its slot 
+ * and the generation of the slot. a slot is reused with its 
+ * generation bumped, so a stale handle, e.g. echoed back by a
+ * late reply, does not find the slot's next owner. only changed 
+ * with the workers paused, like the node lists.
+ */
+struct krk_node_slot {
+    struct krk_node *node;
+    unsigned int gen;
+    unsigned int next_free;
+};
+
+static struct krk_node_slot *krk_node_table = NULL;
+static unsigned int krk_node_table_size = 0;
+static unsigned int krk_node_table_free = KRK_NODE_HANDLE_MASK;
+
+/* hot node states by slot index, allocated a chunk at a time */
+static struct krk_node_state *krk_node_states[KRK_NODE_STATE_NR_CHUNKS];
+static unsigned int krk_node_states_nr_chunks = 0;
+
+#define krk_node_state_of(index) \
+    (&krk_node_states[(index) >> KRK_NODE_STATE_CHUNK_BITS] \
+     [(index) & (KRK_NODE_STATE_CHUNK - 1)])
+
+/**
+ * probes in flight, i.e. nodes holding a connection, and the
+ * queues of waiting ones. each event loop has its own, they 
+ * are only touched from the thread running that loop.
+ */
+struct krk_monitor_shard {
+    struct list_head pending_monitors[KRK_MONITOR_PRIO_NR];
+    unsigned int max_inflight;
+    unsigned int nr_inflight;
+    struct krk_event *dispatch_ev;
+
+    /* results on loop 0, verdicts on the workers, see krk_monitor_post */
+    struct krk_ring *inbox;
+    struct krk_event *inbox_ev;
+    unsigned int inbox_kicked;
+    unsigned long nr_batches;
+    unsigned long nr_dropped;
+};
+
+static struct krk_monitor_shard krk_monitor_shards[KRK_EVENT_LOOP_MAX];
+
+#define krk_monitor_shard() (&krk_monitor_shards[krk_current_loop->id])
+#define krk_pending_monitors (krk_monitor_shard()->pending_monitors)
+#define krk_max_inflight (krk_monitor_shard()->max_inflight)
+#define krk_nr_inflight (krk_monitor_shard()->nr_inflight)
+#define krk_dispatch_ev (krk_monitor_shard()->dispatch_ev)
+
+static void krk_monitor_node_adapt(struct krk_monitor *monitor, 
+        struct krk_node *node, struct krk_monitor_result *res);
+static void krk_monitor_inbox_handler(int sock, short type, void *arg);
 
 void krk_monitor_notify(struct krk_monitor *monitor, 
         struct krk_node *node)
@@ -69,7 +129,7 @@ void krk_monitor_notify(struct krk_monitor *monitor,
         sprintf(port, "%d", node->port);
 
         if (execlp(monitor->notify_script, monitor->notify_script_name, 
-                    monitor->name, node->addr, port, node->down ? "down" : "up", NULL) < 0) {
+                    monitor->name, node->addr, port, node->state->down ? "down" : "up", NULL) < 0) {
             exit(1);
         }
     } else if (notifier > 0) {
@@ -77,6 +137,60 @@ void krk_monitor_notify(struct krk_monitor *monitor,
     }
 }
 
+static unsigned int krk_monitor_name_hash(const char *name)
+{
+    return krk_hash_fnv(name, strlen(name), KRK_HASH_FNV_INIT);
+}
+
+static unsigned int krk_monitor_key_hash(struct krk_node_key *key)
+{
+    return krk_hash_fnv(key, sizeof(struct krk_node_key), KRK_HASH_FNV_INIT);
+}
+
+/**
+ * krk_monitor_parse_key - node key of an address string
+ * @addr: "a.b.c.d" or "[ipv6]"
+ * @port: port of the node
+ * @key: filled with the key
+ *
+ * return KRK_OK for success;
+ * KRK_ERROR for an invalid address.
+ */
+static int krk_monitor_parse_key(const char *addr, unsigned short port, 
+        struct krk_node_key *key)
+{
+    char buf[KRK_IPADDR_LEN];
+    struct in_addr in;
+    size_t len;
+
+    memset(key, 0, sizeof(struct krk_node_key));
+    key->port = port;
+
+    if (addr[0] == '[') {
+        len = strlen(addr);
+        if (len < 3 || len - 2 >= sizeof(buf) || addr[len - 1] != ']') {
+            return KRK_ERROR;
+        }
+
+        memcpy(buf, addr + 1, len - 2);
+        buf[len - 2] = 0;
+
+        if (inet_pton(AF_INET6, buf, key->addr) != 1) {
+            return KRK_ERROR;
+        }
+
+        key->ipv6 = 1;
+    } else {
+        if (inet_aton(addr, &in) == 0) {
+            return KRK_ERROR;
+        }
+
+        memcpy(key->addr, &in, sizeof(struct in_addr));
+    }
+
+    return KRK_OK;
+}
+
 /**
  * krk_monitor_find - find a monitor by name
  * @name: name of monitor to find.
@@ -86,11 +200,14 @@ void krk_monitor_notify(struct krk_monitor *monitor,
 struct krk_monitor* krk_monitor_find(const char *name)
 {
     struct krk_monitor *tmp;
-    struct list_head *p, *n;
+    struct krk_hash_link *pos;
+    unsigned int hash;
 
-    list_for_each_safe(p, n, &krk_all_monitors) {
-        tmp = list_entry(p, struct krk_monitor, list);
-        if (!strcmp(name, tmp->name)) {
+    hash = krk_monitor_name_hash(name);
+
+    krk_hash_for_each(pos, &krk_monitor_index, hash) {
+        tmp = container_of(pos, struct krk_monitor, hash);
+        if (pos->hash == hash && !strcmp(name, tmp->name)) {
             return tmp;
         }
     }
@@ -117,36 +234,328 @@ int krk_monitor_get_all_monitors(struct krk_monitor *monitors)
     return i;
 }
 
-void krk_monitor_timeout_handler(int sock, short type, void *arg)
+/**
+ * krk_monitor_node_offset - phase offset of a node inside the jitter window
+ * @monitor: monitor the node belongs to
+ * @node: node to place
+ *
+ * the offset is a FNV-1a hash of "addr:port", so a node keeps its
+ * slot across reloads and the nodes of a monitor are spread evenly
+ * over the window instead of being probed on the same tick.
+ *
+ * return offset in microseconds.
+ */
+static unsigned long krk_monitor_node_offset(struct krk_monitor *monitor,
+        struct krk_node *node)
+{
+    unsigned long window;
+    unsigned int hash = 2166136261U;
+    char key[KRK_IPADDR_LEN + 8];
+    int i, len;
+
+    window = monitor->jitter;
+    if (window == 0) {
+        return 0;
+    }
+
+    len = snprintf(key, sizeof(key), "%s:%u", node->addr, node->port);
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619U;
+    }
+
+    return hash % window;
+}
+
+/**
+ * krk_monitor_node_schedule - plan the next probe of a node
+ * @node: node to schedule
+ * @usec: delay from now
+ *
+ * this starts a new phase, the periodic rescheduling is
+ * done by krk_monitor_node_advance.
+ */
+static void krk_monitor_node_schedule(struct krk_node *node, 
+        unsigned long usec)
+{
+    node->state->deadline = krk_time_usec() + usec;
+
+    krk_event_add_at(node->tmout_ev, node->state->deadline);
+}
+
+/**
+ * krk_monitor_node_advance - move a node to its next deadline
+ * @monitor: monitor the node belongs to
+ * @node: node whose probe just came due
+ * @now: current monotonic time in usec
+ * @interval: distance to the next deadline, in usec
+ *
+ * the deadline moves by whole intervals from the previous
+ * one instead of from now, so the time spent in handlers does
+ * not accumulate. a node which fell more than one interval 
+ * behind skips the missed cycles and keeps its phase.
+ */
+static void krk_monitor_node_advance(struct krk_monitor *monitor, 
+        struct krk_node *node, unsigned long long now, unsigned long interval)
+{
+    unsigned long long missed;
+
+    node->state->deadline += interval;
+
+    if (node->state->deadline <= now) {
+        missed = (now - node->state->deadline) / interval + 1;
+        node->state->deadline += missed * interval;
+        monitor->nr_missed += missed;
+    }
+
+    krk_event_add_at(node->tmout_ev, node->state->deadline);
+}
+
+static void krk_monitor_lag_update(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    unsigned long long now;
+    unsigned long lag;
+
+    now = krk_time_usec();
+    lag = now > node->state->planned ? now - node->state->planned : 0;
+
+    monitor->lag_last = lag;
+    if (lag > monitor->lag_max) {
+        monitor->lag_max = lag;
+    }
+    monitor->lag_sum += lag;
+    monitor->nr_lag++;
+}
+
+/**
+ * krk_monitor_node_probe - start a probe on a node
+ * @monitor: monitor the node belongs to
+ * @node: node to probe
+ *
+ * return value of the checker, KRK_BUSY means the probe could
+ * not get a connection and should be tried again later.
+ */
+static int krk_monitor_node_probe(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    int ret;
+
+    krk_monitor_lag_update(monitor, node);
+
+    ret = monitor->checker->process_node(node, monitor->checker_param);
+    if (ret == KRK_ERROR) {
+        /* TODO: just log, do nothing */
+    } else if (ret == KRK_OK) {
+        /* TODO: just log, do nothing */
+    } else if (ret == KRK_AGAIN) {
+        /* TODO: just log, do nothing */
+    } 
+
+    return ret;
+}
+
+static void krk_monitor_dispatch_schedule(unsigned long usec)
+{
+    krk_event_set_timeout(krk_dispatch_ev, usec);
+    krk_event_add(krk_dispatch_ev);
+}
+
+/**
+ * krk_monitor_node_defer - queue a probe until a slot is free
+ * @monitor: monitor the node belongs to
+ * @node: node to queue
+ *
+ * a node is queued at most once, a probe coming due while the
+ * previous one is still waiting is merged into it.
+ */
+static void krk_monitor_node_defer(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    monitor->nr_deferred++;
+
+    if (!list_empty(&node->pending)) {
+        return;
+    }
+
+    list_add_tail(&node->pending, &monitor->pending_list);
+    monitor->nr_pending++;
+
+    if (list_empty(&monitor->pending)) {
+        list_add_tail(&monitor->pending, 
+                &krk_pending_monitors[monitor->priority]);
+    }
+}
+
+static void krk_monitor_node_undefer(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    if (list_empty(&node->pending)) {
+        return;
+    }
+
+    list_del_init(&node->pending);
+    monitor->nr_pending--;
+
+    if (list_empty(&monitor->pending_list)) {
+        list_del_init(&monitor->pending);
+        monitor->deficit = 0;
+    }
+}
+
+/**
+ * krk_monitor_pending_prio - highest class with waiting probes
+ * @
+ *
+ * return the class, -1 if nothing is waiting.
+ */
+static int krk_monitor_pending_prio(void)
+{
+    int prio;
+
+    for (prio = KRK_MONITOR_PRIO_NR - 1; prio >= 0; prio--) {
+        if (!list_empty(&krk_pending_monitors[prio])) {
+            return prio;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * krk_monitor_dispatch_handler - start waiting probes
+ *
+ * the classes are served in strict priority order. inside a 
+ * class it is deficit round robin over the monitors which have 
+ * waiting probes: each round a monitor earns KRK_MONITOR_DRR_QUANTUM 
+ * and starts one probe per unit of deficit, so a monitor with
+ * thousands of nodes can not starve one with a handful.
+ */
+static void krk_monitor_dispatch_handler(int sock, short type, void *arg)
+{
+    struct krk_monitor *monitor;
+    struct krk_node *node;
+    int prio, ret;
+
+    while ((prio = krk_monitor_pending_prio()) >= 0
+            && krk_nr_inflight < krk_max_inflight) {
+        monitor = list_first_entry(&krk_pending_monitors[prio], 
+                struct krk_monitor, pending);
+        monitor->deficit += KRK_MONITOR_DRR_QUANTUM;
+
+        while (monitor->deficit > 0 
+                && !list_empty(&monitor->pending_list)
+                && krk_nr_inflight < krk_max_inflight) {
+            node = list_first_entry(&monitor->pending_list, 
+                    struct krk_node, pending);
+            list_del_init(&node->pending);
+            monitor->nr_pending--;
+            monitor->deficit--;
+
+            ret = krk_monitor_node_probe(monitor, node);
+            if (ret == KRK_BUSY) {
+                list_add(&node->pending, &monitor->pending_list);
+                monitor->nr_pending++;
+                monitor->deficit++;
+                krk_monitor_dispatch_schedule(KRK_MONITOR_DISPATCH_RETRY);
+                return;
+            }
+        }
+
+        list_del_init(&monitor->pending);
+        if (list_empty(&monitor->pending_list)) {
+            monitor->deficit = 0;
+        } else {
+            list_add_tail(&monitor->pending, &krk_pending_monitors[prio]);
+        }
+    }
+}
+
+/**
+ * krk_monitor_node_timeout_handler - a node's probe came due
+ *
+ * the probe starts right away if a slot is free and nothing of 
+ * the same or a higher class is waiting, otherwise it is queued.
+ * while a higher class is waiting the probe is shed instead,
+ * and the node's next deadline is stretched by KRK_MONITOR_STRETCH.
+ * the low classes are stretched as well while the loop lags.
+ */
+void krk_monitor_node_timeout_handler(int sock, short type, void *arg)
 {
     struct krk_event *ev;
     struct krk_monitor *monitor;
-    struct list_head *p, *n;
-    struct krk_node *tmp;
-    int ret;
+    struct krk_node *node;
+    unsigned long long now, deadline;
+    unsigned long interval, stretch;
+    int prio, ret;
 
     ev = arg;
-    monitor = ev->data;
+    node = ev->data;
+    monitor = node->parent;
 
-    list_for_each_safe(p, n, &monitor->node_list) {
-        tmp = list_entry(p, struct krk_node, list);
+    now = krk_time_usec();
+    deadline = node->state->deadline;
+    stretch = 1;
+
+    if (node->state->ready) {
+        /* a probe still waiting keeps its planned start */
+        if (list_empty(&node->pending)) {
+            node->state->planned = node->state->deadline;
+        }
 
-        if (tmp->ready) {
-            ret = monitor->checker->process_node(tmp, monitor->checker_param);
-            if (ret == KRK_ERROR) {
-                /* TODO: just log, do nothing */
-            } else if (ret == KRK_OK) {
-                /* TODO: just log, do nothing */
-            } else if (ret == KRK_AGAIN) {
-                /* TODO: just log, do nothing */
-            } 
+        prio = krk_monitor_pending_prio();
+
+        if (prio > (int)monitor->priority) {
+            monitor->nr_shed++;
+            stretch *= KRK_MONITOR_STRETCH;
+        } else if (prio == (int)monitor->priority
+                || krk_nr_inflight >= krk_max_inflight) {
+            /* waiting probes go first, or they may never get a slot */
+            krk_monitor_node_defer(monitor, node);
+        } else {
+            ret = krk_monitor_node_probe(monitor, node);
+            if (ret == KRK_BUSY) {
+                krk_monitor_node_defer(monitor, node);
+                krk_monitor_dispatch_schedule(KRK_MONITOR_DISPATCH_RETRY);
+            }
+        }
 
-            krk_log(KRK_LOG_INFO, "node %s:%d, nr_fail: %u, nr_success: %u\n", 
-                    tmp->addr, tmp->port, tmp->nr_fail, tmp->nr_success); 
+        /* a lagging loop gives the low classes less to do */
+        if (krk_event_loop_overloaded() 
+                && monitor->priority <= KRK_MONITOR_LAG_PRIO) {
+            monitor->nr_stretched++;
+            stretch *= KRK_MONITOR_STRETCH;
         }
     }
 
-    krk_event_add(monitor->tmout_ev);
+    /**
+     * a result which came back within the probe went through
+     * krk_monitor_node_adapt already. a suspect node was given a 
+     * new deadline there, otherwise the interval may have changed.
+     */
+    if (node->state->deadline != deadline) {
+        return;
+    }
+
+    interval = node->state->cur_interval * stretch;
+
+    krk_monitor_node_advance(monitor, node, now, interval);
+}
+
+static void krk_monitor_node_start(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    node->state->offset = krk_monitor_node_offset(monitor, node);
+    node->state->cur_interval = monitor->interval;
+    node->state->backoff = 0;
+
+    krk_monitor_node_schedule(node, node->state->offset);
+}
+
+static void krk_monitor_node_stop(struct krk_node *node)
+{
+    krk_event_del(node->tmout_ev);
+    krk_monitor_node_undefer(node->parent, node);
 }
 
 /**
@@ -186,24 +595,23 @@ struct krk_monitor* krk_monitor_create(const char *name)
 
     memset(monitor, 0, sizeof(struct krk_monitor));
     INIT_LIST_HEAD(&monitor->node_list);
+    INIT_LIST_HEAD(&monitor->pending_list);
+    INIT_LIST_HEAD(&monitor->pending);
 
-    monitor->tmout_ev = krk_event_create(0);
-    if (monitor->tmout_ev == NULL) {
+    if (krk_hash_init(&monitor->node_index, 0) != KRK_OK) {
         free(monitor);
-        krk_log(KRK_LOG_ALERT,"create event failed!\n");
         return NULL;
     }
 
-    monitor->tmout_ev->data = (void *)monitor; 
-    monitor->tmout_ev->handler = krk_monitor_timeout_handler;
-    krk_event_set_timer(monitor->tmout_ev);
-
     strncpy(monitor->name, name, KRK_NAME_LEN);
     monitor->name[KRK_NAME_LEN - 1] = 0;
 
     list_add_tail(&monitor->list, &krk_all_monitors);
+    krk_hash_add(&krk_monitor_index, &monitor->hash, 
+            krk_monitor_name_hash(monitor->name));
 
-    monitor->id = krk_nr_monitors;
+    monitor->loop = krk_event_loop_pick(monitor->name);
+    monitor->id = krk_monitor_next_id++;
 
     krk_nr_monitors++;
 
@@ -212,23 +620,37 @@ struct krk_monitor* krk_monitor_create(const char *name)
 
 int krk_monitor_destroy(struct krk_monitor *monitor)
 {
+    struct krk_event_loop *saved;
+    int ret;
+
     if (!monitor) {
         return KRK_ERROR;
     }
 
-    krk_event_destroy(monitor->tmout_ev);
+    saved = krk_event_loop_switch(monitor->loop);
 
-    if (krk_monitor_destroy_all_nodes(monitor)
-            != KRK_OK) {
+    krk_monitor_disable(monitor);
+    ret = krk_monitor_destroy_all_nodes(monitor);
+
+    krk_event_loop_switch(saved);
+
+    if (ret != KRK_OK) {
         return KRK_ERROR;
     }
 
     list_del(&monitor->list);
+    krk_hash_del(&krk_monitor_index, &monitor->hash);
+
+    krk_hash_destroy(&monitor->node_index);
 
     if (monitor->parsed_checker_param) {
         free(monitor->parsed_checker_param);
     }
 
+    if (monitor->checker_param) {
+        free(monitor->checker_param);
+    }
+
     krk_monitor_destroy_ssl(monitor);
     
     free(monitor);
@@ -238,34 +660,41 @@ int krk_monitor_destroy(struct krk_monitor *monitor)
     return KRK_OK;
 }
 
+/**
+ * krk_remove_unused_monitor - destroy the monitors gone from the config
+ * @conf: the new config
+ *
+ * mark and sweep: the monitors of the config are looked up
+ * and marked, what is left unmarked goes.
+ */
 int krk_remove_unused_monitor(struct krk_config *conf)
 {
     struct krk_config_monitor *conf_monitor = NULL;
     struct krk_monitor *monitor = NULL;
     struct list_head *p, *n;
-    int found = 0;
-    int ret = 0;
+    int ret = KRK_OK;
+
+    for (conf_monitor = conf->monitor; conf_monitor != NULL; 
+            conf_monitor = conf_monitor->next) {
+        monitor = krk_monitor_find(conf_monitor->monitor);
+        if (monitor != NULL) {
+            monitor->marked = 1;
+        }
+    }
 
     list_for_each_safe(p, n, &krk_all_monitors) {
-        found = 0;
         monitor = list_entry(p, struct krk_monitor, list);
-        conf_monitor = conf->monitor;
-        while (conf_monitor != NULL) {
-            if (!strcmp(monitor->name, conf_monitor->monitor)) {
-                found = 1;
-                break;
-            }
-            conf_monitor = conf_monitor->next;
+        if (monitor->marked) {
+            monitor->marked = 0;
+            continue;
         }
-        if (!found) {
-            ret = krk_monitor_destroy(monitor);
-            if (ret == KRK_ERROR) {
-                return ret;
-            }
+
+        if (krk_monitor_destroy(monitor) == KRK_ERROR) {
+            ret = KRK_ERROR;
         }
     }
 
-    return KRK_OK;
+    return ret;
 }
 
 int krk_all_monitors_destroy(void)
@@ -287,17 +716,28 @@ int krk_all_monitors_destroy(void)
 struct krk_node* krk_monitor_find_node(const char *addr, 
         const unsigned short port, struct krk_monitor *monitor)
 {
+    struct krk_node_key key;
+    struct krk_hash_link *pos;
     struct krk_node *tmp;
-    struct list_head *p, *n;
+    unsigned int hash;
 
     if (addr == NULL || monitor == NULL || port == 0) {
         return NULL;
     }
 
-    list_for_each_safe(p, n, &monitor->node_list) {
-        tmp = list_entry(p, struct krk_node, list);
-        if (!strcmp(addr, tmp->addr)
-                && port == tmp->port) {
+    if (krk_monitor_parse_key(addr, port, &key) != KRK_OK) {
+        return NULL;
+    }
+
+    hash = krk_monitor_key_hash(&key);
+
+    krk_hash_for_each(pos, &monitor->node_index, hash) {
+        if (pos->hash != hash) {
+            continue;
+        }
+
+        tmp = container_of(pos, struct krk_node, hash);
+        if (!memcmp(&key, &tmp->state->key, sizeof(struct krk_node_key))) {
             return tmp;
         }
     }
@@ -305,24 +745,137 @@ struct krk_node* krk_monitor_find_node(const char *addr,
     return NULL;
 }
 
-struct krk_node* krk_monitor_find_node_by_id(const unsigned char id, 
+/**
+ * krk_monitor_find_node_by_handle - look a node up by its handle
+ * @handle: node->id of the node
+ *
+ * return the node; NULL if the handle is stale or invalid.
+ */
+struct krk_node* krk_monitor_find_node_by_handle(unsigned int handle)
+{
+    struct krk_node_slot *slot;
+    unsigned int index;
+
+    index = handle & KRK_NODE_HANDLE_MASK;
+    if (index >= krk_node_table_size) {
+        return NULL;
+    }
+
+    slot = &krk_node_table[index];
+    if (slot->node == NULL
+            || slot->gen != (handle >> KRK_NODE_HANDLE_BITS)) {
+        return NULL;
+    }
+
+    return slot->node;
+}
+
+struct krk_node* krk_monitor_find_node_by_id(const unsigned int id, 
         struct krk_monitor *monitor)
 {
     struct krk_node *tmp;
-    struct list_head *p, *n;
 
     if (monitor == NULL) {
         return NULL;
     }
 
-    list_for_each_safe(p, n, &monitor->node_list) {
-        tmp = list_entry(p, struct krk_node, list);
-        if (id == tmp->id) {
-            return tmp;
+    tmp = krk_monitor_find_node_by_handle(id);
+    if (tmp == NULL || tmp->parent != monitor) {
+        return NULL;
+    }
+
+    return tmp;
+}
+
+/**
+ * krk_node_handle_get - give a node its handle
+ * @node: node to give a handle to
+ *
+ * the table doubles when no slot is free.
+ *
+ * return KRK_OK on success, KRK_ERROR if out of memory or slots.
+ */
+static int krk_node_handle_get(struct krk_node *node)
+{
+    struct krk_node_slot *slots, *slot;
+    struct krk_node_state *chunk;
+    unsigned int size, i;
+
+    if (krk_node_table_free == KRK_NODE_HANDLE_MASK) {
+        size = krk_node_table_size ? 
+            krk_node_table_size * 2 : KRK_NODE_TABLE_MIN_SIZE;
+        if (size > KRK_NODE_MAX_NUM) {
+            size = KRK_NODE_MAX_NUM;
+        }
+
+        if (size == krk_node_table_size) {
+            return KRK_ERROR;
         }
+
+        slots = realloc(krk_node_table, size * sizeof(struct krk_node_slot));
+        if (slots == NULL) {
+            return KRK_ERROR;
+        }
+
+        /* chain the new slots, lowest index first */
+        for (i = size; i > krk_node_table_size; i--) {
+            slot = &slots[i - 1];
+            slot->node = NULL;
+            slot->gen = 1;
+            slot->next_free = krk_node_table_free;
+            krk_node_table_free = i - 1;
+        }
+
+        krk_node_table = slots;
+        krk_node_table_size = size;
     }
 
-    return NULL;
+    i = krk_node_table_free;
+
+    if (krk_node_states[i >> KRK_NODE_STATE_CHUNK_BITS] == NULL) {
+        if (posix_memalign((void **)&chunk, KRK_NODE_STATE_CACHELINE, 
+                    KRK_NODE_STATE_CHUNK * sizeof(struct krk_node_state))) {
+            return KRK_ERROR;
+        }
+        memset(chunk, 0, KRK_NODE_STATE_CHUNK * sizeof(struct krk_node_state));
+
+        krk_node_states[i >> KRK_NODE_STATE_CHUNK_BITS] = chunk;
+        krk_node_states_nr_chunks++;
+    }
+
+    slot = &krk_node_table[i];
+    krk_node_table_free = slot->next_free;
+
+    slot->node = node;
+    node->id = krk_node_handle(i, slot->gen);
+
+    node->state = krk_node_state_of(i);
+    memset(node->state, 0, sizeof(struct krk_node_state));
+    node->state->used = 1;
+
+    return KRK_OK;
+}
+
+static void krk_node_handle_put(struct krk_node *node)
+{
+    struct krk_node_slot *slot;
+    unsigned int index;
+
+    index = node->id & KRK_NODE_HANDLE_MASK;
+    slot = &krk_node_table[index];
+
+    memset(node->state, 0, sizeof(struct krk_node_state));
+    node->state = NULL;
+
+    slot->node = NULL;
+    /* generation 0 is skipped, no handle is 0 */
+    slot->gen = (slot->gen + 1) & KRK_NODE_HANDLE_GEN_MASK;
+    if (slot->gen == 0) {
+        slot->gen = 1;
+    }
+
+    slot->next_free = krk_node_table_free;
+    krk_node_table_free = index;
 }
 
 int krk_monitor_add_node_connection(struct krk_node *node, struct krk_connection *conn)
@@ -340,6 +893,9 @@ int krk_monitor_add_node_connection(struct krk_node *node, struct krk_connection
     }
 
 #if 1
+    if (node->conn == NULL) {
+        krk_nr_inflight++;
+    }
     node->conn = conn;
 #else
     list_add_tail(&conn->node, &node->connection_list);
@@ -357,6 +913,12 @@ int krk_monitor_remove_node_connection(struct krk_node *node, struct krk_connect
     }
 
 #if 1
+    if (node->conn != NULL) {
+        krk_nr_inflight--;
+        if (krk_monitor_pending_prio() >= 0) {
+            krk_monitor_dispatch_schedule(0);
+        }
+    }
     node->conn = NULL;
 #else
     list_del(&conn->node);
@@ -369,12 +931,16 @@ int krk_monitor_remove_node_connection(struct krk_node *node, struct krk_connect
 void krk_monitor_destroy_node_connections(struct krk_node *node)
 {
 #if 1
+    struct krk_connection *conn;
+
     if (node == NULL) {
         return;
     }
 
     if (node->conn) {
-        krk_connection_destroy(node->conn);
+        conn = node->conn;
+        krk_monitor_remove_node_connection(node, conn);
+        krk_connection_destroy(conn);
     }
 #else
     struct krk_connection *tmp;
@@ -397,14 +963,15 @@ void krk_monitor_destroy_node_connections(struct krk_node *node)
 struct krk_node* krk_monitor_create_node(const char *addr, unsigned short port)
 {
     struct krk_node *node = NULL;
-    int ret = KRK_OK;
+    struct krk_node_key key;
 
     if (!addr || port == 0) {
         return NULL;
     }
 
-    if (krk_nr_nodes > KRK_NODE_MAX_NUM) {
-        krk_log(KRK_LOG_ALERT, "node number is bigger than the limit %d\n",KRK_NODE_MAX_NUM);
+    if (krk_nr_nodes >= krk_max_nodes) {
+        krk_log(KRK_LOG_ALERT, "node number (%u) is full(%u)!\n", 
+                krk_nr_nodes, krk_max_nodes);
         return NULL;
     }
 
@@ -415,18 +982,29 @@ struct krk_node* krk_monitor_create_node(const char *addr, unsigned short port)
 
     memset(node, 0, sizeof(struct krk_node));
 
-    if (addr[0] == '[') {
-        node->ipv6 = 1;
+    node->tmout_ev = krk_event_create(0);
+    if (node->tmout_ev == NULL) {
+        free(node);
+        return NULL;
     }
 
-    if (node->ipv6) {
-    } else {
-        ret = inet_aton(addr, &node->inaddr.sin_addr);
-        if (ret == 0) {
-            free(node);
-            return NULL;
-        }
+    /* armed with krk_event_add_at, no relative timeout */
+    node->tmout_ev->data = (void *)node;
+    node->tmout_ev->handler = krk_monitor_node_timeout_handler;
+    krk_event_set_timer(node->tmout_ev);
 
+    if (krk_monitor_parse_key(addr, port, &key) != KRK_OK) {
+        krk_event_destroy(node->tmout_ev);
+        free(node);
+        return NULL;
+    }
+
+    if (key.ipv6) {
+        memcpy(&node->in6addr.sin6_addr, key.addr, sizeof(struct in6_addr));
+        node->in6addr.sin6_port = htons(port);
+        node->in6addr.sin6_family = AF_INET6;
+    } else {
+        memcpy(&node->inaddr.sin_addr, key.addr, sizeof(struct in_addr));
         node->inaddr.sin_port = htons(port);
         node->inaddr.sin_family = AF_INET;
     }
@@ -435,12 +1013,19 @@ struct krk_node* krk_monitor_create_node(const char *addr, unsigned short port)
     node->addr[KRK_IPADDR_LEN - 1] = 0;
 
     node->port = port;
-    node->down = 1;
 
     INIT_LIST_HEAD(&node->connection_list);
+    INIT_LIST_HEAD(&node->pending);
 
-    /* id begins at 0 */
-    node->id = krk_nr_nodes;
+    if (krk_node_handle_get(node) != KRK_OK) {
+        krk_log(KRK_LOG_ALERT, "no handle left for node %s\n", addr);
+        krk_event_destroy(node->tmout_ev);
+        free(node);
+        return NULL;
+    }
+
+    node->state->key = key;
+    node->state->down = 1;
 
     krk_nr_nodes++;
 
@@ -455,6 +1040,10 @@ int krk_monitor_destroy_node(struct krk_node *node)
 
     krk_monitor_destroy_node_connections(node);
 
+    krk_event_destroy(node->tmout_ev);
+
+    krk_node_handle_put(node);
+
     free(node);
 
     krk_nr_nodes--;
@@ -485,6 +1074,7 @@ int krk_monitor_destroy_all_nodes(struct krk_monitor *monitor)
 int krk_monitor_add_node(struct krk_monitor *monitor, 
         struct krk_node *node)
 {
+    
     if (monitor == NULL
             || node == NULL) {
         return KRK_ERROR;
@@ -495,12 +1085,28 @@ int krk_monitor_add_node(struct krk_monitor *monitor,
     list_add_tail(&node->list, &monitor->node_list);
     monitor->nr_nodes++;
 
+    krk_hash_add(&monitor->node_index, &node->hash, 
+            krk_monitor_key_hash(&node->state->key));
+
     if (monitor->checker->init_node(node)
             != KRK_OK) {
-        return KRK_ERROR;
+        goto failed;
+    }
+
+    if (monitor->enabled) {
+        krk_monitor_node_start(monitor, node);
     }
 
     return KRK_OK;
+
+failed:
+    /* back out, the node is left as krk_monitor_create_node made it */
+    krk_hash_del(&monitor->node_index, &node->hash);
+    list_del(&node->list);
+    monitor->nr_nodes--;
+    node->parent = NULL;
+
+    return KRK_ERROR;
 }
 
 int krk_monitor_remove_node(struct krk_monitor *monitor,
@@ -511,7 +1117,10 @@ int krk_monitor_remove_node(struct krk_monitor *monitor,
         return KRK_ERROR;
     }
 
+    krk_monitor_node_stop(node);
+
     list_del(&node->list);
+    krk_hash_del(&monitor->node_index, &node->hash);
     node->parent = NULL;
     monitor->nr_nodes--;
 
@@ -523,44 +1132,50 @@ int krk_monitor_remove_node(struct krk_monitor *monitor,
     return KRK_OK;
 }
 
+/**
+ * krk_remove_unused_node - destroy the nodes gone from a monitor's config
+ * @conf_monitor: the new config of the monitor
+ * @monitor: monitor to clean
+ *
+ * mark and sweep like krk_remove_unused_monitor, the cost is
+ * linear in the number of nodes.
+ */
 int krk_remove_unused_node(struct krk_config_monitor *conf_monitor, struct krk_monitor *monitor)
 {
     struct list_head *p, *n;
     struct krk_node *tmp;
     struct krk_config_node *node;
-    int found = 0;
     int ret = KRK_OK;
 
+    for (node = conf_monitor->node; node != NULL; node = node->next) {
+        tmp = krk_monitor_find_node(node->addr, node->port, monitor);
+        if (tmp != NULL) {
+            tmp->marked = 1;
+        }
+    }
+
     list_for_each_safe(p, n, &monitor->node_list) {
         tmp = list_entry(p, struct krk_node, list);
-        node = conf_monitor->node;
-        found = 0;
-        while (node != NULL) {
-            if (!strcmp(node->addr, tmp->addr) && 
-                        node->port == tmp->port) {
-                found = 1;
-                break;
-            }
-            node = node->next;
+        if (tmp->marked) {
+            tmp->marked = 0;
+            continue;
         }
-        if (!found) {
-            ret = krk_monitor_remove_node(monitor, tmp);
-            if (ret == KRK_ERROR) {
-                krk_monitor_destroy_node(tmp);
-                return ret;
-            }
-            ret = krk_monitor_destroy_node(tmp);
-            if (ret == KRK_ERROR) {
-                return ret;
-            }
+
+        /* keep sweeping, no mark may be left behind */
+        if (krk_monitor_remove_node(monitor, tmp) == KRK_ERROR) {
+            ret = KRK_ERROR;
+        }
+
+        if (krk_monitor_destroy_node(tmp) == KRK_ERROR) {
+            ret = KRK_ERROR;
         }
     }
 
-    return KRK_OK;
+    return ret;
 }
 
-int krk_mointor_set_node_status(struct krk_monitor *monitor, 
-        unsigned char id, int status)
+int krk_monitor_set_node_status(struct krk_monitor *monitor, 
+        unsigned int id, int status)
 {
     struct krk_node *node;
 
@@ -569,7 +1184,7 @@ int krk_mointor_set_node_status(struct krk_monitor *monitor,
         return KRK_ERROR;
     }
 
-    node->down = status;
+    node->state->down = status;
 
     return KRK_OK;
 }
@@ -613,32 +1228,6 @@ int krk_monitor_get_all_nodes(struct krk_monitor *monitor,
     return i;
 }
 
-int krk_monitor_get_nodes_by_addr(const char *addr, 
-        struct krk_node *nodes)
-{
-    struct list_head *p, *n;
-    struct list_head *k, *m;
-    struct krk_monitor *tmp;
-    struct krk_node *tmp_node;
-    int i = 0;
-
-    list_for_each_safe(p, n, &krk_all_monitors) {
-        tmp = list_entry(p, struct krk_monitor, list);
-
-        list_for_each_safe(k, m, &tmp->node_list) {
-            tmp_node = list_entry(k, struct krk_node, list);
-            if (!strcmp(addr, tmp_node->addr)) {
-                memcpy(&nodes[i], tmp_node, sizeof(struct krk_node));
-                i++;
-                if (i > 255)
-                    return i;
-            }
-        }
-    }
-
-    return i;
-}
-
 static void krk_monitor_show_checker(struct krk_checker *checker)
 {
     fprintf(stderr,"checker name = %s\n",checker->name);
@@ -649,12 +1238,15 @@ static void krk_monitor_show_node(struct krk_node *node)
     fprintf(stderr,"------------node------------\n");
     fprintf(stderr,"node addr = %s\n", node->addr);
     fprintf(stderr,"node port = %u\n", node->port);
-    fprintf(stderr,"node nr_fail = %u\n", node->nr_fail);
-    fprintf(stderr,"node nr_success = %u\n", node->nr_success);
-    fprintf(stderr,"node id = %d\n", node->id);
-    fprintf(stderr,"node ipv6 = %d\n", node->ipv6);
-    fprintf(stderr,"node down = %d\n", node->down);
-    fprintf(stderr,"node ready = %d\n", node->ready);
+    fprintf(stderr,"node nr_fail = %u\n", node->state->nr_fail);
+    fprintf(stderr,"node nr_success = %u\n", node->state->nr_success);
+    fprintf(stderr,"node id = %#x\n", node->id);
+    fprintf(stderr,"node offset = %luus\n", node->state->offset);
+    fprintf(stderr,"node interval = %luus\n", node->state->cur_interval);
+    fprintf(stderr,"node backoff = %luus\n", node->state->backoff);
+    fprintf(stderr,"node ipv6 = %d\n", node->state->key.ipv6);
+    fprintf(stderr,"node down = %d\n", node->state->down);
+    fprintf(stderr,"node ready = %d\n", node->state->ready);
     fprintf(stderr,"------------node end------------\n");
 }
 
@@ -665,11 +1257,16 @@ static void krk_monitor_show_one(struct krk_monitor *monitor)
 
     fprintf(stderr,"============monitor============\n");
     fprintf(stderr,"monitor name = %s\n",monitor->name);
-    fprintf(stderr,"id = %d\n",monitor->id);
-    fprintf(stderr,"interval = %lu\n",monitor->interval);
-    fprintf(stderr,"timeout = %lu\n",monitor->timeout);
+    fprintf(stderr,"id = %u\n",monitor->id);
+    fprintf(stderr,"interval = %luus\n",monitor->interval);
+    fprintf(stderr,"timeout = %luus\n",monitor->timeout);
+    fprintf(stderr,"jitter = %luus\n",monitor->jitter);
+    fprintf(stderr,"suspect interval = %luus\n",monitor->suspect_interval);
+    fprintf(stderr,"stable interval = %luus\n",monitor->stable_interval);
+    fprintf(stderr,"backoff max = %luus\n",monitor->backoff_max);
     fprintf(stderr,"failure threshold = %lu\n",monitor->failure_threshold);
     fprintf(stderr,"success threshold = %lu\n",monitor->success_threshold);
+    fprintf(stderr,"priority = %u\n",monitor->priority);
 
     krk_monitor_show_checker(monitor->checker);
 
@@ -677,6 +1274,16 @@ static void krk_monitor_show_one(struct krk_monitor *monitor)
     fprintf(stderr,"notify_script_name= %s\n",monitor->notify_script_name);
 
     fprintf(stderr,"eanble= %d\n",monitor->enabled);
+    fprintf(stderr,"pending probes = %lu\n",monitor->nr_pending);
+    fprintf(stderr,"deferred probes = %lu\n",monitor->nr_deferred);
+    fprintf(stderr,"shed probes = %lu\n",monitor->nr_shed);
+    fprintf(stderr,"stretched probes = %lu\n",monitor->nr_stretched);
+    fprintf(stderr,"late timeouts = %lu\n",monitor->nr_late);
+    fprintf(stderr,"schedule lag last/avg/max = %lu/%llu/%luus\n",
+            monitor->lag_last, 
+            monitor->nr_lag ? monitor->lag_sum / monitor->nr_lag : 0,
+            monitor->lag_max);
+    fprintf(stderr,"missed cycles = %lu\n",monitor->nr_missed);
 
     list_for_each_safe(k, m, &monitor->node_list) {
         node = list_entry(k, struct krk_node, list);
@@ -685,10 +1292,88 @@ static void krk_monitor_show_one(struct krk_monitor *monitor)
     fprintf(stderr,"============monitor end============\n");
 }
 
+/**
+ * krk_monitor_node_suspect - is a node on its way to a state change
+ * @node: node to check
+ *
+ * an up node collecting failures, or a down node collecting
+ * successes. the counter of the other direction just wraps
+ * at its threshold and means nothing here.
+ */
+static inline int krk_node_state_suspect(struct krk_node_state *state)
+{
+    return state->down ? (state->nr_success != 0) : (state->nr_fail != 0);
+}
+
+static int krk_monitor_node_suspect(struct krk_node *node)
+{
+    return krk_node_state_suspect(node->state);
+}
+
+/**
+ * krk_monitor_scan_states - count the down and the suspect nodes
+ * @nr_down: where to put the number of down nodes
+ * @nr_suspect: where to put the number of suspect nodes
+ *
+ * one pass over the dense state array, no node is touched.
+ *
+ * return number of nodes scanned.
+ */
+static unsigned int krk_monitor_scan_states(unsigned int *nr_down, 
+        unsigned int *nr_suspect)
+{
+    struct krk_node_state *state, *end;
+    unsigned int i, nr = 0;
+
+    *nr_down = *nr_suspect = 0;
+
+    for (i = 0; i < KRK_NODE_STATE_NR_CHUNKS; i++) {
+        if (krk_node_states[i] == NULL) {
+            continue;
+        }
+
+        end = krk_node_states[i] + KRK_NODE_STATE_CHUNK;
+        for (state = krk_node_states[i]; state < end; state++) {
+            if (!state->used) {
+                continue;
+            }
+
+            nr++;
+            *nr_down += state->down;
+            *nr_suspect += krk_node_state_suspect(state);
+        }
+    }
+
+    return nr;
+}
+
 void krk_monitor_show(void)
 {
     struct list_head *p, *n;
     struct krk_monitor *monitor;
+    struct krk_monitor_shard *shard;
+    unsigned int i, nr_down, nr_suspect;
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        shard = &krk_monitor_shards[i];
+        fprintf(stderr,"loop %u: probes in flight = %u/%u\n",
+                i, shard->nr_inflight, shard->max_inflight);
+        if (shard->inbox) {
+            fprintf(stderr,"loop %u: %s queued = %lu, handled = %lu, "
+                    "batches = %lu, dropped = %lu\n",
+                    i, i ? "verdicts" : "results", 
+                    krk_ring_count(shard->inbox), shard->inbox->nr_pop, 
+                    shard->nr_batches, shard->nr_dropped);
+        }
+    }
+
+    fprintf(stderr,"monitors = %u/%u, nodes = %u/%u, node handles = %u\n",
+            krk_nr_monitors, krk_max_monitors, krk_nr_nodes, krk_max_nodes,
+            krk_node_table_size);
+
+    krk_monitor_scan_states(&nr_down, &nr_suspect);
+    fprintf(stderr,"nodes down = %u, suspect = %u, state chunks = %u\n",
+            nr_down, nr_suspect, krk_node_states_nr_chunks);
 
     list_for_each_safe(p, n, &krk_all_monitors) {
         monitor = list_entry(p, struct krk_monitor, list);
@@ -698,69 +1383,480 @@ void krk_monitor_show(void)
 
 void krk_monitor_enable(struct krk_monitor *monitor)
 {
+    struct list_head *p, *n;
+    struct krk_node *node;
+
     if (monitor->enabled == 0) {
         monitor->enabled = 1;
 
-        monitor->tmout_ev->timeout = malloc(sizeof(struct timeval));
-        monitor->tmout_ev->timeout->tv_sec = monitor->interval;
-        monitor->tmout_ev->timeout->tv_usec = 0;
-
-        krk_event_add(monitor->tmout_ev);
+        list_for_each_safe(p, n, &monitor->node_list) {
+            node = list_entry(p, struct krk_node, list);
+            krk_monitor_node_start(monitor, node);
+        }
     }
 }
 
 void krk_monitor_disable(struct krk_monitor *monitor)
 {
+    struct list_head *p, *n;
+    struct krk_node *node;
+
     if (monitor->enabled == 1) {
         monitor->enabled = 0;
 
-        free(monitor->tmout_ev->timeout);
-        monitor->tmout_ev->timeout = NULL;
+        list_for_each_safe(p, n, &monitor->node_list) {
+            node = list_entry(p, struct krk_node, list);
+            krk_monitor_node_stop(node);
+        }
+    }
+}
+
+/**
+ * krk_monitor_shard_init - create the events of the current loop's shard
+ * @
+ *
+ * return KRK_OK for success;
+ * KRK_ERROR for failed.
+ */
+static int krk_monitor_shard_init(void)
+{
+    struct krk_monitor_shard *shard = krk_monitor_shard();
 
-        krk_event_del(monitor->tmout_ev);
+    if (shard->dispatch_ev == NULL) {
+        shard->dispatch_ev = krk_event_create(0);
+        if (shard->dispatch_ev == NULL) {
+            return KRK_ERROR;
+        }
+
+        shard->dispatch_ev->handler = krk_monitor_dispatch_handler;
+        krk_event_set_timer(shard->dispatch_ev);
+    }
+
+    if (shard->inbox == NULL) {
+        shard->inbox = krk_ring_create(KRK_MONITOR_RESULT_RING, 
+                sizeof(struct krk_monitor_result));
+        if (shard->inbox == NULL) {
+            return KRK_ERROR;
+        }
     }
+
+    if (shard->inbox_ev == NULL) {
+        shard->inbox_ev = krk_event_create(0);
+        if (shard->inbox_ev == NULL) {
+            return KRK_ERROR;
+        }
+
+        shard->inbox_ev->handler = krk_monitor_inbox_handler;
+        krk_event_set(-1, shard->inbox_ev, 0);
+    }
+
+    return KRK_OK;
+}
+
+/**
+ * krk_monitor_set_max_inflight - set the probe budget
+ * @max: number of probes allowed in flight at once, per loop
+ *
+ * probes over the budget wait in their monitor's queue and are
+ * started as in-flight probes finish. raising the budget drains
+ * the queues right away. the workers must be paused.
+ */
+void krk_monitor_set_max_inflight(unsigned int max)
+{
+    struct krk_event_loop *saved;
+    unsigned int i;
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        saved = krk_event_loop_switch(krk_event_loop_get(i));
+
+        krk_max_inflight = max;
+
+        /* a worker started after init */
+        (void)krk_monitor_shard_init();
+
+        if (krk_monitor_pending_prio() >= 0) {
+            krk_monitor_dispatch_schedule(0);
+        }
+
+        krk_event_loop_switch(saved);
+    }
+}
+
+/**
+ * krk_monitor_set_limits - set how many monitors and nodes may exist
+ * @max_monitors: limit of monitors
+ * @max_nodes: limit of nodes over all monitors, up to KRK_NODE_MAX_NUM
+ *
+ * lowering a limit under the current number only refuses new ones.
+ */
+void krk_monitor_set_limits(unsigned long max_monitors, 
+        unsigned long max_nodes)
+{
+    if (max_monitors > UINT_MAX) {
+        max_monitors = UINT_MAX;
+    }
+
+    if (max_nodes > KRK_NODE_MAX_NUM) {
+        max_nodes = KRK_NODE_MAX_NUM;
+    }
+
+    krk_max_monitors = max_monitors;
+    krk_max_nodes = max_nodes;
 }
 
 int krk_monitor_init(void)
 {
+    struct krk_monitor_shard *shard;
+    int i, j;
+
     INIT_LIST_HEAD(&krk_all_monitors);
 
-    krk_max_monitors = KRK_MONITOR_MAX_NR;
+    for (i = 0; i < KRK_EVENT_LOOP_MAX; i++) {
+        shard = &krk_monitor_shards[i];
 
-    return KRK_OK;
+        for (j = 0; j < KRK_MONITOR_PRIO_NR; j++) {
+            INIT_LIST_HEAD(&shard->pending_monitors[j]);
+        }
+        shard->max_inflight = KRK_CONF_DEFAULT_MAX_INFLIGHT;
+    }
+
+    krk_monitor_set_limits(KRK_CONF_DEFAULT_MAX_MONITORS, 
+            KRK_CONF_DEFAULT_MAX_NODES);
+
+    if (krk_hash_init(&krk_monitor_index, 0) != KRK_OK) {
+        return KRK_ERROR;
+    }
+
+    /* the workers' are created with their loops */
+    return krk_monitor_shard_init();
 }
 
+/**
+ * krk_monitor_exit - destroy all monitors
+ * @
+ *
+ * the workers must have been stopped.
+ */
 int krk_monitor_exit(void)
 {
-    return krk_all_monitors_destroy();
+    struct krk_event_loop *saved;
+    unsigned int i;
+    int ret;
+
+    ret = krk_all_monitors_destroy();
+
+    krk_hash_destroy(&krk_monitor_index);
+
+    free(krk_node_table);
+    krk_node_table = NULL;
+    krk_node_table_size = 0;
+    krk_node_table_free = KRK_NODE_HANDLE_MASK;
+
+    for (i = 0; i < KRK_NODE_STATE_NR_CHUNKS; i++) {
+        free(krk_node_states[i]);
+        krk_node_states[i] = NULL;
+    }
+    krk_node_states_nr_chunks = 0;
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        saved = krk_event_loop_switch(krk_event_loop_get(i));
+
+        if (krk_dispatch_ev) {
+            krk_event_destroy(krk_dispatch_ev);
+            krk_dispatch_ev = NULL;
+        }
+
+        /* the workers are gone, whatever is left is just dropped */
+        if (krk_monitor_shard()->inbox_ev) {
+            krk_event_destroy(krk_monitor_shard()->inbox_ev);
+            krk_monitor_shard()->inbox_ev = NULL;
+        }
+
+        if (krk_monitor_shard()->inbox) {
+            krk_ring_destroy(krk_monitor_shard()->inbox);
+            krk_monitor_shard()->inbox = NULL;
+        }
+
+        krk_event_loop_switch(saved);
+    }
+
+    return ret;
 }
 
-void krk_monitor_node_failure_inc(struct krk_monitor *monitor, 
-        struct krk_node *node)
+/**
+ * krk_monitor_node_adapt - adapt the probe interval to the node state
+ * @monitor: monitor the node belongs to
+ * @node: node which just got a probe result
+ * @res: verdict of the probe, result and the node state it led to
+ *
+ * suspect nodes are probed at suspect_interval, and the next probe
+ * is pulled in right away. stable up nodes relax by 1/4 of their
+ * current interval per success, up to stable_interval. down nodes
+ * double their interval per failure, up to backoff_max, and the 
+ * first success resets the backoff.
+ *
+ * runs on the monitor's loop, the node state is only known from
+ * the verdict.
+ */
+static void krk_monitor_node_adapt(struct krk_monitor *monitor, 
+        struct krk_node *node, struct krk_monitor_result *res)
 {
-    node->nr_fail++;
-    if (node->nr_fail == monitor->failure_threshold) {
-        node->nr_fail = 0;
-        node->nr_success = 0;
-        if (!node->down) {
-            node->down = 1;
-            krk_monitor_notify(monitor, node);
+    struct krk_node_state *state = node->state;
+    unsigned long interval;
+
+    if (res->success) {
+        state->backoff = 0;
+    }
+
+    if (res->suspect) {
+        if (state->cur_interval != monitor->suspect_interval) {
+            state->cur_interval = monitor->suspect_interval;
+            if (monitor->enabled && state->ready) {
+                krk_monitor_node_schedule(node, state->cur_interval);
+            }
+        }
+        return;
+    }
+
+    if (res->down) {
+        if (!res->success) {
+            interval = state->backoff ? state->backoff : monitor->interval;
+            interval *= 2;
+            if (interval > monitor->backoff_max) {
+                interval = monitor->backoff_max;
+            }
+            state->backoff = interval;
         }
+
+        state->cur_interval = state->backoff ? state->backoff : monitor->interval;
+        return;
+    }
+
+    if (!res->success) {
+        state->cur_interval = monitor->interval;
+        return;
+    }
+
+    interval = state->cur_interval;
+    if (interval < monitor->interval) {
+        interval = monitor->interval;
+    }
+
+    interval += interval / 4;
+    if (interval > monitor->stable_interval) {
+        interval = monitor->stable_interval;
     }
+
+    state->cur_interval = interval;
+}
+
+/**
+ * krk_monitor_post - queue a result or a verdict to a loop
+ * @loop: loop to run it on
+ * @res: copied into the loop's ring
+ *
+ * safe from any thread. the loop is woken once per batch,
+ * not per entry. a full ring drops the entry, as if the
+ * probe had not been made.
+ */
+static void krk_monitor_post(struct krk_event_loop *loop, 
+        struct krk_monitor_result *res)
+{
+    struct krk_monitor_shard *shard = &krk_monitor_shards[loop->id];
+
+    if (krk_ring_push(shard->inbox, res) != KRK_OK) {
+        __atomic_fetch_add(&shard->nr_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (!__atomic_exchange_n(&shard->inbox_kicked, 1, __ATOMIC_SEQ_CST)) {
+        krk_event_active(shard->inbox_ev, EV_READ);
+    }
+}
+
+/**
+ * krk_monitor_node_apply - run the state machine of a node
+ * @res: result of a probe, turned into its verdict
+ *
+ * only loop 0 changes nr_fail, nr_success and down, and
+ * only it runs the notify script.
+ */
+static void krk_monitor_node_apply(struct krk_monitor_result *res)
+{
+    struct krk_monitor *monitor = res->monitor;
+    struct krk_node *node = res->node;
+    struct krk_node_state *state = node->state;
+
+    if (res->success) {
+        state->nr_success++;
+        if (state->nr_success == monitor->success_threshold) {
+            state->nr_success = 0;
+            state->nr_fail = 0;
+            if (state->down) {
+                state->down = 0;
+                krk_monitor_notify(monitor, node);
+            }
+        }
+    } else {
+        state->nr_fail++;
+        if (state->nr_fail == monitor->failure_threshold) {
+            state->nr_fail = 0;
+            state->nr_success = 0;
+            if (!state->down) {
+                state->down = 1;
+                krk_monitor_notify(monitor, node);
+            }
+        }
+    }
+
+    krk_log(KRK_LOG_INFO, "node %s:%d, nr_fail: %u, nr_success: %u\n", 
+            node->addr, node->port, state->nr_fail, state->nr_success); 
+
+    res->down = state->down;
+    res->suspect = krk_monitor_node_suspect(node);
+
+    if (monitor->loop == krk_current_loop) {
+        krk_monitor_node_adapt(monitor, node, res);
+    } else {
+        krk_monitor_post(monitor->loop, res);
+    }
+}
+
+/**
+ * krk_monitor_inbox_drain - handle what is queued to the current loop
+ * @max: most entries to handle
+ *
+ * results are applied on loop 0, verdicts adapted on workers.
+ *
+ * return number of entries handled.
+ */
+static unsigned long krk_monitor_inbox_drain(unsigned long max)
+{
+    struct krk_monitor_shard *shard = krk_monitor_shard();
+    struct krk_monitor_result res;
+    unsigned long n;
+
+    if (shard->inbox == NULL) {
+        /* a worker which has not been set up yet */
+        return 0;
+    }
+
+    /* entries queued from now on wake us again */
+    __atomic_store_n(&shard->inbox_kicked, 0, __ATOMIC_SEQ_CST);
+
+    for (n = 0; n < max; n++) {
+        if (krk_ring_pop(shard->inbox, &res) != KRK_OK) {
+            break;
+        }
+
+        if (krk_current_loop->id == 0) {
+            krk_monitor_node_apply(&res);
+        } else {
+            krk_monitor_node_adapt(res.monitor, res.node, &res);
+        }
+    }
+
+    return n;
+}
+
+static void krk_monitor_inbox_handler(int sock, short type, void *arg)
+{
+    struct krk_monitor_shard *shard = krk_monitor_shard();
+
+    shard->nr_batches++;
+
+    /* let io in between batches */
+    if (krk_monitor_inbox_drain(KRK_MONITOR_RESULT_BATCH) == KRK_MONITOR_RESULT_BATCH
+            && krk_ring_count(shard->inbox)
+            && !__atomic_exchange_n(&shard->inbox_kicked, 1, __ATOMIC_SEQ_CST)) {
+        krk_event_active(shard->inbox_ev, EV_READ);
+    }
+}
+
+/**
+ * krk_monitor_results_flush - handle all the queued results and verdicts
+ * @
+ *
+ * nothing may stay queued while nodes are destroyed, the
+ * entries point to them. the workers must be paused.
+ */
+void krk_monitor_results_flush(void)
+{
+    struct krk_event_loop *saved;
+    unsigned int i;
+
+    if (krk_event_loop_nr_workers() == 0) {
+        return;
+    }
+
+    saved = krk_event_loop_switch(krk_event_loop_get(0));
+    krk_monitor_inbox_drain(ULONG_MAX);
+
+    for (i = 1; i <= krk_event_loop_nr_workers(); i++) {
+        krk_event_loop_switch(krk_event_loop_get(i));
+        krk_monitor_inbox_drain(ULONG_MAX);
+    }
+
+    krk_event_loop_switch(saved);
+}
+
+/**
+ * krk_monitor_node_result - report the result of a probe
+ * @monitor: monitor the node belongs to
+ * @node: node probed
+ * @success: result of the probe
+ *
+ * a worker never touches the verdict part of the node state,
+ * the result goes to loop 0 and the verdict comes back later.
+ */
+static void krk_monitor_node_result(struct krk_monitor *monitor, 
+        struct krk_node *node, int success)
+{
+    struct krk_monitor_result res;
+
+    memset(&res, 0, sizeof(struct krk_monitor_result));
+    res.monitor = monitor;
+    res.node = node;
+    res.success = success ? 1 : 0;
+
+    if (krk_current_loop->id == 0) {
+        krk_monitor_node_apply(&res);
+    } else {
+        krk_monitor_post(krk_event_loop_get(0), &res);
+    }
+}
+
+void krk_monitor_node_failure_inc(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    krk_monitor_node_result(monitor, node, 0);
 }
 
 void krk_monitor_node_success_inc(struct krk_monitor *monitor, 
         struct krk_node *node)
 {
-    node->nr_success++;
-    if (node->nr_success == monitor->success_threshold) {
-        node->nr_success = 0;
-        node->nr_fail = 0;
-        if (node->down) {
-            node->down = 0;
-            krk_monitor_notify(monitor, node);
-        }
+    krk_monitor_node_result(monitor, node, 1);
+}
+
+/**
+ * krk_monitor_node_timeout_inc - a probe timed out
+ * @monitor: monitor the node belongs to
+ * @node: node probed
+ *
+ * while the loop lags the reply may well be sitting unread, 
+ * the timeout says nothing about the node and is not counted.
+ */
+void krk_monitor_node_timeout_inc(struct krk_monitor *monitor, 
+        struct krk_node *node)
+{
+    if (krk_event_loop_overloaded()) {
+        monitor->nr_late++;
+        krk_log(KRK_LOG_DEBUG, "node %s:%d, late timeout ignored\n", 
+                node->addr, node->port);
+        return;
     }
+
+    krk_monitor_node_result(monitor, node, 0);
 }
 
 void krk_monitor_node_cleanup(struct krk_node *node, struct krk_connection *conn)
@@ -775,6 +1871,16 @@ void krk_get_monitor_info(struct krk_monitor_info *info,
     strncpy(info->name, monitor->name, KRK_NAME_LEN);
     strncpy(info->checker, monitor->checker->name, KRK_NAME_LEN);
     info->nr_nodes = monitor->nr_nodes;
+    info->nr_pending = monitor->nr_pending;
+    info->nr_deferred = monitor->nr_deferred;
+    info->nr_shed = monitor->nr_shed;
+    info->nr_stretched = monitor->nr_stretched;
+    info->nr_late = monitor->nr_late;
+    info->priority = monitor->priority;
+    info->lag_last = monitor->lag_last;
+    info->lag_avg = monitor->nr_lag ? monitor->lag_sum / monitor->nr_lag : 0;
+    info->lag_max = monitor->lag_max;
+    info->nr_missed = monitor->nr_missed;
     info->enabled =  monitor->enabled;
 }
 
@@ -783,6 +1889,15 @@ void krk_show_monitor_info(struct krk_monitor_info *info)
     fprintf(stderr,"monitor name = %s\n",info->name);
     fprintf(stderr,"checker = %s\n",info->checker);
     fprintf(stderr,"node number = %ld\n",info->nr_nodes);
+    fprintf(stderr,"priority = %u\n",info->priority);
+    fprintf(stderr,"pending probes = %lu\n",info->nr_pending);
+    fprintf(stderr,"deferred probes = %lu\n",info->nr_deferred);
+    fprintf(stderr,"shed probes = %lu\n",info->nr_shed);
+    fprintf(stderr,"stretched probes = %lu\n",info->nr_stretched);
+    fprintf(stderr,"late timeouts = %lu\n",info->nr_late);
+    fprintf(stderr,"schedule lag last/avg/max = %lu/%lu/%luus\n",
+            info->lag_last, info->lag_avg, info->lag_max);
+    fprintf(stderr,"missed cycles = %lu\n",info->nr_missed);
     if (info->enabled) {
         fprintf(stderr,"monitor enabled\n");
     } else {
@@ -795,11 +1910,13 @@ static void krk_get_node_info(struct krk_node_info *info,
 {
     strncpy(info->addr, node->addr, KRK_IPADDR_LEN);
     info->port = node->port;
-    info->nr_fail = node->nr_fail;
-    info->nr_success = node->nr_success;
-    info->ipv6 = node->ipv6;
-    info->down = node->down;
-    info->ready = node->ready;
+    info->nr_fail = node->state->nr_fail;
+    info->nr_success = node->state->nr_success;
+    info->cur_interval = node->state->cur_interval;
+    info->backoff = node->state->backoff;
+    info->ipv6 = node->state->key.ipv6;
+    info->down = node->state->down;
+    info->ready = node->state->ready;
 }
 
 void krk_show_node_info(struct krk_node_info *info)
@@ -808,18 +1925,27 @@ void krk_show_node_info(struct krk_node_info *info)
     fprintf(stderr,"port = %d\n",info->port);
     fprintf(stderr,"nr_fail = %d\n",info->nr_fail);
     fprintf(stderr,"nr_success = %d\n",info->nr_success);
+    fprintf(stderr,"interval = %luus\n",info->cur_interval);
+    fprintf(stderr,"backoff = %luus\n",info->backoff);
     fprintf(stderr,"ipv6 = %d\n",info->ipv6);
     fprintf(stderr,"down = %d\n",info->down);
     fprintf(stderr,"ready = %d\n",info->ready);
 }
 
-size_t krk_info_buffer_size(void)
+/**
+ * krk_info_buffer_size - size of the info of the monitors
+ * @monitor: monitor to get the info of, NULL for the names of all
+ *
+ * sized on what exists now, not on the limits.
+ */
+size_t krk_info_buffer_size(struct krk_monitor *monitor)
 {
-    size_t monitor_buf_size = (KRK_MONITOR_MAX_NR * KRK_NAME_LEN);
-    size_t node_buf_size = (sizeof(struct krk_monitor_info) + KRK_NODE_MAX_NUM * sizeof(struct krk_node_info));
-    size_t max_buf_size = monitor_buf_size > node_buf_size?monitor_buf_size:node_buf_size;
+    if (monitor == NULL) {
+        return krk_nr_monitors * KRK_NAME_LEN;
+    }
 
-    return max_buf_size;
+    return sizeof(struct krk_monitor_info) 
+        + monitor->nr_nodes * sizeof(struct krk_node_info);
 }
 
 int krk_get_all_monitor_name(char *buf) 
@@ -0,0 +1,179 @@
+/**
+ * krk_pool.c - Krake object pool
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <krk_core.h>
+#include <krk_pool.h>
+
+#include <krk_log.h>
+
+void krk_pool_init(struct krk_pool *pool, const char *name,
+        pool_alloc alloc, pool_release release);
+struct list_head* krk_pool_get(struct krk_pool *pool);
+void krk_pool_put(struct krk_pool *pool, struct list_head *item);
+void krk_pool_trim(struct krk_pool *pool);
+void krk_pool_destroy(struct krk_pool *pool);
+void krk_pool_show(struct krk_pool *pool);
+
+static void krk_pool_trim_handler(struct krk_timer *timer)
+{
+    krk_pool_trim(timer->data);
+}
+
+/**
+ * krk_pool_init - init a pool
+ * @pool: pool to init
+ * @name: name of the pool, for statistics
+ * @alloc: creates a new, fully initialised object
+ * @release: frees an object for good
+ *
+ */
+void krk_pool_init(struct krk_pool *pool, const char *name,
+        pool_alloc alloc, pool_release release)
+{
+    memset(pool, 0, sizeof(struct krk_pool));
+
+    strncpy(pool->name, name, KRK_NAME_LEN);
+    pool->name[KRK_NAME_LEN - 1] = 0;
+
+    INIT_LIST_HEAD(&pool->free_list);
+
+    pool->alloc = alloc;
+    pool->release = release;
+
+    krk_timer_init(&pool->trim_timer, krk_pool_trim_handler, pool);
+}
+
+/**
+ * krk_pool_get - get an object from a pool
+ * @pool: pool to get from
+ *
+ * the most recently freed object is handed out first,
+ * it is the most likely one to be still in cache.
+ *
+ * return list_head embedded in the object;
+ * NULL if the pool is empty and allocating failed.
+ */
+struct list_head* krk_pool_get(struct krk_pool *pool)
+{
+    struct list_head *item;
+
+    if (!list_empty(&pool->free_list)) {
+        item = pool->free_list.next;
+        list_del_init(item);
+        pool->nr_free--;
+        pool->nr_hit++;
+    } else {
+        item = pool->alloc();
+        if (item == NULL) {
+            return NULL;
+        }
+        pool->nr_miss++;
+    }
+
+    pool->nr_used++;
+    if (pool->nr_used > pool->high_water) {
+        pool->high_water = pool->nr_used;
+    }
+
+    return item;
+}
+
+/**
+ * krk_pool_put - give an object back to a pool
+ * @pool: pool the object was got from
+ * @item: list_head embedded in the object
+ *
+ * the object must be reset by the caller, it is handed out
+ * again as it is.
+ */
+void krk_pool_put(struct krk_pool *pool, struct list_head *item)
+{
+    struct timeval tv;
+
+    list_add(item, &pool->free_list);
+    pool->nr_free++;
+    pool->nr_used--;
+
+    /* an idle pool does not keep a timer around */
+    if (!pool->trim_timer.pending) {
+        tv.tv_sec = KRK_POOL_TRIM_INTERVAL;
+        tv.tv_usec = 0;
+        krk_timer_add(&pool->trim_timer, &tv);
+    }
+}
+
+/**
+ * krk_pool_trim - give memory of unused objects back
+ * @pool: pool to trim
+ *
+ * the free list is cut down to what it takes to reach the
+ * peak usage since the last trim again, then a new period
+ * starts with the current usage as its peak.
+ */
+void krk_pool_trim(struct krk_pool *pool)
+{
+    struct list_head *item;
+    unsigned long keep, nr = 0;
+
+    keep = pool->high_water - pool->nr_used;
+
+    while (pool->nr_free > keep) {
+        item = pool->free_list.prev;
+        list_del_init(item);
+        pool->nr_free--;
+        pool->release(item);
+        nr++;
+    }
+
+    pool->nr_trimmed += nr;
+    pool->high_water = pool->nr_used;
+
+    if (nr) {
+        krk_log(KRK_LOG_DEBUG, "pool %s trimmed %lu, free: %lu, used: %lu\n",
+                pool->name, nr, pool->nr_free, pool->nr_used);
+    }
+}
+
+/**
+ * krk_pool_destroy - release all the free objects of a pool
+ * @pool: pool to destroy
+ *
+ * objects still in use are not tracked, they have to be
+ * released by their owners.
+ */
+void krk_pool_destroy(struct krk_pool *pool)
+{
+    struct list_head *item;
+
+    krk_timer_del(&pool->trim_timer);
+
+    while (!list_empty(&pool->free_list)) {
+        item = pool->free_list.next;
+        list_del_init(item);
+        pool->release(item);
+    }
+
+    pool->nr_free = 0;
+}
+
+void krk_pool_show(struct krk_pool *pool)
+{
+    unsigned long total;
+
+    total = pool->nr_hit + pool->nr_miss;
+
+    fprintf(stderr,"pool %s: used = %lu, free = %lu, high water = %lu\n",
+            pool->name, pool->nr_used, pool->nr_free, pool->high_water);
+    fprintf(stderr,"pool %s: hit = %lu, miss = %lu, hit rate = %lu%%, trimmed = %lu\n",
+            pool->name, pool->nr_hit, pool->nr_miss,
+            total ? pool->nr_hit * 100 / total : 0, pool->nr_trimmed);
+}
@@ -0,0 +1,164 @@
+/**
+ * krk_ring.c - Krake lock-free MPSC ring
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <krk_core.h>
+#include <krk_ring.h>
+
+struct krk_ring* krk_ring_create(unsigned int size, size_t entry_size);
+void krk_ring_destroy(struct krk_ring *ring);
+int krk_ring_push(struct krk_ring *ring, const void *entry);
+int krk_ring_pop(struct krk_ring *ring, void *entry);
+unsigned long krk_ring_count(struct krk_ring *ring);
+
+#define krk_ring_slot(ring, pos) \
+    ((struct krk_ring_slot *)((ring)->slots + ((pos) & (ring)->mask) * (ring)->slot_size))
+
+/**
+ * krk_ring_create - create a ring
+ * @size: number of entries, rounded up to a power of 2
+ * @entry_size: size of one entry
+ *
+ * return address of new ring for success;
+ * NULL for failed.
+ */
+struct krk_ring* krk_ring_create(unsigned int size, size_t entry_size)
+{
+    struct krk_ring *ring;
+    unsigned long n, i;
+    void *p;
+
+    for (n = 2; n < size; n <<= 1) {
+        /* void */
+    }
+
+    if (posix_memalign(&p, KRK_RING_CACHELINE, sizeof(struct krk_ring))) {
+        return NULL;
+    }
+
+    ring = p;
+    memset(ring, 0, sizeof(struct krk_ring));
+
+    ring->mask = n - 1;
+    ring->entry_size = entry_size;
+    ring->slot_size = (sizeof(struct krk_ring_slot) + entry_size 
+            + sizeof(unsigned long) - 1) & ~(sizeof(unsigned long) - 1);
+
+    ring->slots = malloc(n * ring->slot_size);
+    if (ring->slots == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    /* slot i is free for the producer taking position i */
+    for (i = 0; i < n; i++) {
+        krk_ring_slot(ring, i)->seq = i;
+    }
+
+    return ring;
+}
+
+void krk_ring_destroy(struct krk_ring *ring)
+{
+    free(ring->slots);
+    free(ring);
+}
+
+/**
+ * krk_ring_push - add an entry to a ring
+ * @ring: ring to push to
+ * @entry: copied into the ring
+ *
+ * safe from any thread.
+ *
+ * return KRK_OK for success;
+ * KRK_BUSY if the ring is full.
+ */
+int krk_ring_push(struct krk_ring *ring, const void *entry)
+{
+    struct krk_ring_slot *slot;
+    unsigned long pos, seq;
+    long diff;
+
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    for ( ;; ) {
+        slot = krk_ring_slot(ring, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (long)(seq - pos);
+
+        if (diff == 0) {
+            /* our turn, if no other producer takes pos first */
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* the consumer has not freed this slot yet */
+            __atomic_fetch_add(&ring->nr_full, 1, __ATOMIC_RELAXED);
+            return KRK_BUSY;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->data, entry, ring->entry_size);
+
+    /* publish to the consumer */
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_ring_pop - take the oldest entry off a ring
+ * @ring: ring to pop from
+ * @entry: filled with the entry
+ *
+ * only one thread may pop from a ring.
+ *
+ * return KRK_OK for success;
+ * KRK_AGAIN if the ring is empty.
+ */
+int krk_ring_pop(struct krk_ring *ring, void *entry)
+{
+    struct krk_ring_slot *slot;
+    unsigned long pos;
+
+    pos = ring->head;
+    slot = krk_ring_slot(ring, pos);
+
+    /* an entry still being copied in reads as empty */
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return KRK_AGAIN;
+    }
+
+    memcpy(entry, slot->data, ring->entry_size);
+
+    /* hand the slot to the producer of the next lap */
+    __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+
+    ring->head = pos + 1;
+    ring->nr_pop++;
+
+    return KRK_OK;
+}
+
+/**
+ * krk_ring_count - entries waiting in a ring
+ * @ring: ring to count
+ *
+ * only a snapshot while producers are running.
+ */
+unsigned long krk_ring_count(struct krk_ring *ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) - ring->head;
+}
@@ -28,7 +28,7 @@ void krk_local_accept(int listen_sock, short type, void *arg)
 	unsigned int remote_addr_size;
 	struct krk_event *event;
 	struct krk_connection *conn;
-    size_t wbuff_size = krk_info_buffer_size();
+    size_t wbuff_size = LOCAL_SOCK_BUFSZ;
 
 	remote_addr_size = sizeof(struct sockaddr_un);
 	sock = accept(listen_sock, (struct sockaddr *)&remote_addr, 
@@ -163,6 +163,45 @@ int krk_socket_raw_create(int protocol)
     return sock;
 }
 
+int krk_socket_dgram_create(int protocol)
+{
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, protocol);
+
+    if (sock > 0) {
+        fcntl(sock, F_SETFL, O_NONBLOCK);
+    }
+
+    return sock;
+}
+
+int krk_socket_raw6_create(int protocol)
+{
+    int sock;
+
+    sock = socket(AF_INET6, SOCK_RAW, protocol);
+
+    if (sock > 0) {
+        fcntl(sock, F_SETFL, O_NONBLOCK);
+    }
+
+    return sock;
+}
+
+int krk_socket_dgram6_create(int protocol)
+{
+    int sock;
+
+    sock = socket(AF_INET6, SOCK_DGRAM, protocol);
+
+    if (sock > 0) {
+        fcntl(sock, F_SETFL, O_NONBLOCK);
+    }
+
+    return sock;
+}
+
 int krk_socket_tcp_connect(int sock, struct krk_node *node)
 {
     int ret;
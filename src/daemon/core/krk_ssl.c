@@ -9,12 +9,39 @@
  * the Free Software Foundation; either version 2 of the License, or
  * (at your option) any later version.
  */
+#include <pthread.h>
+
 #include <krk_core.h>
 #include <krk_log.h>
 #include <krk_ssl.h>
+#include <krk_arena.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/* older openssl needs locks to be used from the worker threads */
+static pthread_mutex_t *krk_ssl_locks = NULL;
+
+static void krk_ssl_locking_callback(int mode, int n, 
+        const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK) {
+        pthread_mutex_lock(&krk_ssl_locks[n]);
+    } else {
+        pthread_mutex_unlock(&krk_ssl_locks[n]);
+    }
+}
+
+static unsigned long krk_ssl_id_callback(void)
+{
+    return (unsigned long)pthread_self();
+}
+#endif
 
 int krk_ssl_init(void)
 {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    int i;
+#endif
+
     OPENSSL_config(NULL);
 
     SSL_library_init();
@@ -22,11 +49,41 @@ int krk_ssl_init(void)
 
     OpenSSL_add_all_algorithms();
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    krk_ssl_locks = malloc(CRYPTO_num_locks() * sizeof(pthread_mutex_t));
+    if (krk_ssl_locks == NULL) {
+        return KRK_ERROR;
+    }
+
+    for (i = 0; i < CRYPTO_num_locks(); i++) {
+        pthread_mutex_init(&krk_ssl_locks[i], NULL);
+    }
+
+    CRYPTO_set_id_callback(krk_ssl_id_callback);
+    CRYPTO_set_locking_callback(krk_ssl_locking_callback);
+#endif
+
     return KRK_OK;
 }
 
 int krk_ssl_exit(void)
 {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    int i;
+
+    if (krk_ssl_locks) {
+        CRYPTO_set_locking_callback(NULL);
+        CRYPTO_set_id_callback(NULL);
+
+        for (i = 0; i < CRYPTO_num_locks(); i++) {
+            pthread_mutex_destroy(&krk_ssl_locks[i]);
+        }
+
+        free(krk_ssl_locks);
+        krk_ssl_locks = NULL;
+    }
+#endif
+
     EVP_cleanup();
 
     return KRK_OK;
@@ -94,24 +151,36 @@ int krk_ssl_init_ctx(struct krk_ssl *ssl)
     return KRK_OK;
 }
 
+/**
+ * krk_ssl_create_connection - create a ssl connection on a socket
+ * @sock: connected socket
+ * @ssl: ssl context
+ * @arena: arena of the owning connection, holds the wrapper
+ *
+ * only the wrapper lives in the arena, the SSL object itself
+ * is OpenSSL's and is freed by krk_ssl_destroy_connection.
+ *
+ * return address of the ssl connection for success;
+ * NULL for failed.
+ */
 struct krk_ssl_connection * 
-krk_ssl_create_connection(int sock, struct krk_ssl *ssl)
+krk_ssl_create_connection(int sock, struct krk_ssl *ssl, 
+        struct krk_arena *arena)
 {
     struct krk_ssl_connection *sc;
 
-    sc = malloc(sizeof(struct krk_ssl_connection));
+    sc = krk_arena_calloc(arena, sizeof(struct krk_ssl_connection));
     if (sc == NULL) {
         return NULL;
     }
 
     sc->ssl_connection = SSL_new(ssl->ctx);
     if (sc->ssl_connection == NULL) {
-        free(sc);
         return NULL;
     }
     
     if (SSL_set_fd(sc->ssl_connection, sock) == 0) {
-        free(sc);
+        SSL_free(sc->ssl_connection);
         return NULL;
     }
 
@@ -132,7 +201,7 @@ void krk_ssl_destroy_connection(struct krk_ssl_connection *sc)
         SSL_free(sc->ssl_connection);
     }
 
-    free(sc);
+    /* sc itself goes with the arena of its connection */
 }
 
 void krk_ssl_clear_error(void)
@@ -0,0 +1,902 @@
+/**
+ * krk_uring.c - Krake io_uring engine
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <config.h>
+
+#include <krk_core.h>
+#include <krk_event.h>
+#include <krk_buffer.h>
+#include <krk_uring.h>
+#include <krk_log.h>
+
+int krk_uring_available(void);
+void krk_uring_set_enabled(unsigned int enabled);
+int krk_uring_connect(struct krk_event *event,
+        const struct sockaddr *addr, socklen_t addrlen);
+int krk_uring_send(struct krk_event *event, const void *buf, size_t len);
+int krk_uring_recv(struct krk_event *event, void *buf, size_t len);
+int krk_uring_close(int sock);
+int krk_uring_cancel(struct krk_event *event, uring_done done);
+void krk_uring_drain(void);
+int krk_uring_exit(void);
+void krk_uring_show(void);
+
+static unsigned int krk_uring_enabled = 0;
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* no liburing, the ring is driven by the raw syscalls */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+/* user_data of a cancel, the op id is in the low bits */
+#define KRK_URING_CANCEL_TAG (1ULL << 32)
+
+/**
+ * a cancelled op keeps its slot, and its event, until the
+ * kernel is done with it: its own cqe and the one of its 
+ * cancel are both reaped. done is called then.
+ */
+struct krk_uring_op {
+    struct krk_event *event;
+    uring_done done;            /* set once cancelled */
+    unsigned char opcode;
+    unsigned char nr_cqes;      /* still to reap */
+    unsigned char cancel_wanted;/* no room for the cancel yet */
+    unsigned int next_free;     /* index + 1, 0 ends the free list */
+};
+
+/**
+ * one ring per event loop, only used by the thread running
+ * the loop. submissions made while handling events are
+ * batched, they go to the kernel in one io_uring_enter
+ * at the end of the loop iteration.
+ */
+struct krk_uring {
+    int fd;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail; /* filled but not yet published */
+    unsigned int to_submit;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_sz;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+
+    struct krk_uring_op ops[KRK_URING_ENTRIES];
+    unsigned int free_op;
+    unsigned int nr_ops;
+    unsigned int nr_cancelled;  /* ops whose owner waits for done */
+    unsigned int nr_deferred;   /* cancels waiting for a free sqe */
+
+    struct krk_event *cq_ev;    /* the ring fd is readable on completions */
+    struct krk_event *flush_ev; /* submits the batch */
+
+    unsigned int flush_pending:1;
+    unsigned int failed:1;      /* io_uring_setup refused, use libevent */
+
+    unsigned long nr_enter;
+    unsigned long nr_sqes;
+    unsigned long nr_cqes;
+    unsigned long nr_busy;      /* ops which fell back to libevent */
+};
+
+static struct krk_uring krk_urings[KRK_EVENT_LOOP_MAX];
+
+#define krk_uring_ring() (&krk_urings[krk_current_loop->id])
+
+static void krk_uring_cancel_deferred(struct krk_uring *ring);
+
+static void krk_uring_submit(struct krk_uring *ring)
+{
+    int ret;
+
+    while (ring->to_submit) {
+        ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit,
+                0, 0, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* EBUSY/EAGAIN, retried after the completions are reaped */
+            krk_log(KRK_LOG_DEBUG, "io_uring_enter failed(%d)\n", errno);
+            break;
+        }
+
+        ring->nr_enter++;
+        ring->nr_sqes += ret;
+        ring->to_submit -= ret;
+
+        if (ret == 0) {
+            break;
+        }
+    }
+}
+
+static void krk_uring_complete(struct krk_uring *ring,
+        unsigned long long user_data, int res)
+{
+    struct krk_uring_op *op;
+    struct krk_event *event;
+    unsigned int id;
+    uring_done done;
+    unsigned char opcode;
+    short type;
+
+    /* close, nobody waits for it */
+    if (user_data == 0) {
+        return;
+    }
+
+    id = user_data & ~KRK_URING_CANCEL_TAG;
+    op = &ring->ops[id - 1];
+
+    op->nr_cqes--;
+
+    if (op->done != NULL) {
+        if (!(user_data & KRK_URING_CANCEL_TAG) && op->cancel_wanted) {
+            /* finished before its cancel got a sqe */
+            op->cancel_wanted = 0;
+            ring->nr_deferred--;
+        }
+
+        if (op->nr_cqes > 0) {
+            return;
+        }
+    }
+
+    event = op->event;
+    done = op->done;
+    opcode = op->opcode;
+
+    op->event = NULL;
+    op->done = NULL;
+    op->next_free = ring->free_op;
+    ring->free_op = id;
+    ring->nr_ops--;
+
+    event->uring_op = 0;
+
+    /* cancelled, the kernel is done with what the owner gave */
+    if (done != NULL) {
+        ring->nr_cancelled--;
+        done(event);
+        return;
+    }
+
+    event->result = res;
+
+    switch (opcode) {
+        case IORING_OP_RECV:
+            /* like a persistent read, the deadline covers the response */
+            type = EV_READ;
+            break;
+        default:
+            /* connect and send, only the timeout part is left */
+            type = EV_WRITE;
+            krk_event_del(event);
+            break;
+    }
+
+    event->handler(event->sock, type, event);
+}
+
+/**
+ * krk_uring_reap - complete the operations of the reaped cqes
+ * @ring: ring of the current loop
+ *
+ */
+static void krk_uring_reap(struct krk_uring *ring)
+{
+    struct io_uring_cqe *cqe;
+    unsigned long long user_data;
+    unsigned int head;
+    int res;
+
+    head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        user_data = cqe->user_data;
+        res = cqe->res;
+
+        /* give the slot back before the handler may submit more */
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        ring->nr_cqes++;
+
+        krk_uring_complete(ring, user_data, res);
+    }
+}
+
+static void krk_uring_cq_handler(int sock, short type, void *arg)
+{
+    struct krk_uring *ring = krk_uring_ring();
+
+    krk_uring_reap(ring);
+
+    /* the reaped cqes may have unblocked the submission */
+    if (ring->nr_deferred) {
+        krk_uring_cancel_deferred(ring);
+    }
+
+    if (ring->to_submit) {
+        krk_uring_submit(ring);
+    }
+}
+
+static void krk_uring_flush_handler(int sock, short type, void *arg)
+{
+    struct krk_uring *ring = krk_uring_ring();
+
+    ring->flush_pending = 0;
+
+    if (ring->nr_deferred) {
+        krk_uring_cancel_deferred(ring);
+    }
+
+    krk_uring_submit(ring);
+}
+
+static void krk_uring_unmap(struct krk_uring *ring)
+{
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_sz);
+    }
+
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_sz);
+    }
+
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_sz);
+    }
+
+    ring->sqes = NULL;
+    ring->cq_ring = ring->sq_ring = NULL;
+}
+
+static int krk_uring_setup(struct krk_uring *ring)
+{
+    struct io_uring_params p;
+    unsigned int i;
+
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, KRK_URING_ENTRIES, &p);
+    if (ring->fd < 0) {
+        return KRK_ERROR;
+    }
+
+    ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_sz > ring->sq_ring_sz) {
+            ring->sq_ring_sz = ring->cq_ring_sz;
+        }
+        ring->cq_ring_sz = ring->sq_ring_sz;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto failed;
+        }
+    }
+
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto failed;
+    }
+
+    ring->sq_head = ring->sq_ring + p.sq_off.head;
+    ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+    ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+    ring->sq_array = ring->sq_ring + p.sq_off.array;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = ring->cq_ring + p.cq_off.head;
+    ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+    ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+    ring->cqes = ring->cq_ring + p.cq_off.cqes;
+
+    for (i = 0; i < KRK_URING_ENTRIES; i++) {
+        ring->ops[i].next_free = (i + 1 < KRK_URING_ENTRIES) ? i + 2 : 0;
+    }
+    ring->free_op = 1;
+
+    ring->cq_ev = krk_event_create(0);
+    ring->flush_ev = krk_event_create(0);
+    if (ring->cq_ev == NULL || ring->flush_ev == NULL) {
+        goto failed;
+    }
+
+    /* persistent, re-adding it on each wakeup costs two epoll_ctl */
+    ring->cq_ev->handler = krk_uring_cq_handler;
+    krk_event_set_persist_read(ring->fd, ring->cq_ev);
+    krk_event_add(ring->cq_ev);
+
+    ring->flush_ev->handler = krk_uring_flush_handler;
+    krk_event_set(-1, ring->flush_ev, 0);
+
+    return KRK_OK;
+
+failed:
+    if (ring->cq_ev) {
+        krk_event_destroy(ring->cq_ev);
+        ring->cq_ev = NULL;
+    }
+
+    if (ring->flush_ev) {
+        krk_event_destroy(ring->flush_ev);
+        ring->flush_ev = NULL;
+    }
+
+    krk_uring_unmap(ring);
+    close(ring->fd);
+    ring->fd = -1;
+
+    return KRK_ERROR;
+}
+
+/**
+ * krk_uring_get - the ring of the current loop
+ * @
+ *
+ * set up on first use, a kernel refusing io_uring is only
+ * asked once per loop.
+ *
+ * return the ring, NULL if io_uring is not to be used.
+ */
+static struct krk_uring* krk_uring_get(void)
+{
+    struct krk_uring *ring = krk_uring_ring();
+
+    if (!krk_uring_enabled || ring->failed) {
+        return NULL;
+    }
+
+    if (ring->cq_ev == NULL) {
+        if (krk_uring_setup(ring) != KRK_OK) {
+            krk_log(KRK_LOG_NOTICE, "io_uring unavailable(%d), "
+                    "falling back to libevent\n", errno);
+            ring->failed = 1;
+            return NULL;
+        }
+    }
+
+    return ring;
+}
+
+static struct io_uring_sqe* krk_uring_get_sqe(struct krk_uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int head, idx;
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        krk_uring_submit(ring);
+
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[idx] = idx;
+
+    return sqe;
+}
+
+static void krk_uring_queue(struct krk_uring *ring)
+{
+    ring->sq_local_tail++;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    ring->to_submit++;
+
+    if (!ring->flush_pending) {
+        ring->flush_pending = 1;
+        krk_event_active(ring->flush_ev, EV_WRITE);
+    }
+}
+
+/**
+ * krk_uring_prepare - start an operation for an event
+ * @ring: ring of the current loop
+ * @event: event to complete, one operation at a time
+ * @opcode: IORING_OP_*
+ *
+ * return the sqe to fill and queue;
+ * NULL if the ring is full.
+ */
+static struct io_uring_sqe* krk_uring_prepare(struct krk_uring *ring,
+        struct krk_event *event, unsigned char opcode)
+{
+    struct io_uring_sqe *sqe;
+    struct krk_uring_op *op;
+    unsigned int id;
+
+    if (event->uring_op || ring->free_op == 0) {
+        ring->nr_busy++;
+        return NULL;
+    }
+
+    sqe = krk_uring_get_sqe(ring);
+    if (sqe == NULL) {
+        ring->nr_busy++;
+        return NULL;
+    }
+
+    id = ring->free_op;
+    op = &ring->ops[id - 1];
+    ring->free_op = op->next_free;
+    ring->nr_ops++;
+
+    op->event = event;
+    op->opcode = opcode;
+    op->nr_cqes = 1;
+
+    event->uring_op = id;
+
+    sqe->opcode = opcode;
+    sqe->fd = event->sock;
+    sqe->user_data = id;
+
+    return sqe;
+}
+
+int krk_uring_available(void)
+{
+    return krk_uring_get() != NULL;
+}
+
+/**
+ * krk_uring_connect - connect through the ring
+ * @event: event of the connection, event->sock is connected
+ * @addr: address to connect to
+ * @addrlen: length of addr
+ *
+ * addr must stay valid until the batch is submitted.
+ *
+ * return KRK_OK if the connect is queued;
+ * KRK_BUSY if the caller should use libevent instead.
+ */
+int krk_uring_connect(struct krk_event *event,
+        const struct sockaddr *addr, socklen_t addrlen)
+{
+    struct krk_uring *ring;
+    struct io_uring_sqe *sqe;
+
+    ring = krk_uring_get();
+    if (ring == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe = krk_uring_prepare(ring, event, IORING_OP_CONNECT);
+    if (sqe == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe->addr = (unsigned long)addr;
+    sqe->off = addrlen;
+
+    krk_uring_queue(ring);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_uring_send - send through the ring
+ * @event: event of the connection
+ * @buf: data to send, copied into the event's buffer
+ * @len: length of data
+ *
+ * the handler gets EV_WRITE once the data is sent, 
+ * event->result tells how much.
+ *
+ * return KRK_OK if the send is queued;
+ * KRK_BUSY if the caller should send by itself.
+ */
+int krk_uring_send(struct krk_event *event, const void *buf, size_t len)
+{
+    struct krk_uring *ring;
+    struct io_uring_sqe *sqe;
+
+    if (len > event->buf->size) {
+        return KRK_BUSY;
+    }
+
+    ring = krk_uring_get();
+    if (ring == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe = krk_uring_prepare(ring, event, IORING_OP_SEND);
+    if (sqe == NULL) {
+        return KRK_BUSY;
+    }
+
+    memcpy(event->buf->head, buf, len);
+
+    sqe->addr = (unsigned long)event->buf->head;
+    sqe->len = len;
+
+    krk_uring_queue(ring);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_uring_recv - receive through the ring
+ * @event: event of the connection
+ * @buf: where the data goes
+ * @len: room in buf
+ *
+ * buf must stay valid until the event's handler is called,
+ * or the done of krk_uring_cancel.
+ *
+ * return KRK_OK if the recv is queued;
+ * KRK_BUSY if the caller should use libevent instead.
+ */
+int krk_uring_recv(struct krk_event *event, void *buf, size_t len)
+{
+    struct krk_uring *ring;
+    struct io_uring_sqe *sqe;
+
+    ring = krk_uring_get();
+    if (ring == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe = krk_uring_prepare(ring, event, IORING_OP_RECV);
+    if (sqe == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+
+    krk_uring_queue(ring);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_uring_close - close a socket with the next batch
+ * @sock: socket to close
+ *
+ * return KRK_OK if the close is queued;
+ * KRK_BUSY if the caller should close by itself.
+ */
+int krk_uring_close(int sock)
+{
+    struct krk_uring *ring;
+    struct io_uring_sqe *sqe;
+
+    ring = krk_uring_get();
+    if (ring == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe = krk_uring_get_sqe(ring);
+    if (sqe == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = sock;
+
+    krk_uring_queue(ring);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_uring_queue_cancel - ask the kernel to cancel an op
+ * @ring: ring of the current loop
+ * @id: op to cancel
+ *
+ * return KRK_OK if the cancel is queued;
+ * KRK_BUSY if the submission queue is still full.
+ */
+static int krk_uring_queue_cancel(struct krk_uring *ring, unsigned int id)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = krk_uring_get_sqe(ring);
+    if (sqe == NULL) {
+        return KRK_BUSY;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = id;
+    sqe->user_data = id | KRK_URING_CANCEL_TAG;
+
+    ring->ops[id - 1].nr_cqes++;
+
+    krk_uring_queue(ring);
+
+    return KRK_OK;
+}
+
+/**
+ * krk_uring_cancel_deferred - queue the cancels which found no sqe
+ * @ring: ring of the current loop
+ *
+ * retried on each flush and after each reaping, until
+ * the submission queue has room again.
+ */
+static void krk_uring_cancel_deferred(struct krk_uring *ring)
+{
+    struct krk_uring_op *op;
+    unsigned int i;
+
+    for (i = 0; i < KRK_URING_ENTRIES && ring->nr_deferred; i++) {
+        op = &ring->ops[i];
+
+        if (!op->cancel_wanted) {
+            continue;
+        }
+
+        if (krk_uring_queue_cancel(ring, i + 1) != KRK_OK) {
+            return;
+        }
+
+        op->cancel_wanted = 0;
+        ring->nr_deferred--;
+    }
+}
+
+/**
+ * krk_uring_cancel - cancel the operation of an event
+ * @event: event whose owner is going away
+ * @done: called once the kernel is done with the operation
+ *
+ * the handler is not called any more. until done is called,
+ * the operation may still write into the memory it was given:
+ * the event, its buffer and the owner must be kept. the cancel
+ * is submitted right away, or as soon as the submission queue
+ * has room for it.
+ *
+ * return KRK_OK if no operation is in flight, done is not called;
+ * KRK_AGAIN if done is going to be called.
+ */
+int krk_uring_cancel(struct krk_event *event, uring_done done)
+{
+    struct krk_uring *ring = krk_uring_ring();
+    struct krk_uring_op *op;
+
+    if (!event->uring_op) {
+        return KRK_OK;
+    }
+
+    op = &ring->ops[event->uring_op - 1];
+    if (op->done != NULL) {
+        /* cancelled already */
+        return KRK_AGAIN;
+    }
+
+    op->done = done;
+    ring->nr_cancelled++;
+
+    if (krk_uring_queue_cancel(ring, event->uring_op) != KRK_OK) {
+        op->cancel_wanted = 1;
+        ring->nr_deferred++;
+
+        if (!ring->flush_pending) {
+            ring->flush_pending = 1;
+            krk_event_active(ring->flush_ev, EV_WRITE);
+        }
+
+        return KRK_AGAIN;
+    }
+
+    krk_uring_submit(ring);
+
+    return KRK_AGAIN;
+}
+
+/**
+ * krk_uring_drain - wait for the cancelled operations
+ * @
+ *
+ * for the loop being torn down, its handlers do not run any
+ * more. the owners of the cancelled operations are released
+ * by their done.
+ */
+void krk_uring_drain(void)
+{
+    struct krk_uring *ring = krk_uring_ring();
+    int ret;
+
+    if (ring->cq_ev == NULL) {
+        return;
+    }
+
+    while (ring->nr_cancelled) {
+        if (ring->nr_deferred) {
+            krk_uring_cancel_deferred(ring);
+        }
+
+        krk_uring_submit(ring);
+
+        ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1, 
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            krk_log(KRK_LOG_NOTICE, "io_uring drain failed(%d), "
+                    "%u ops left\n", errno, ring->nr_cancelled);
+            return;
+        }
+
+        krk_uring_reap(ring);
+    }
+}
+
+void krk_uring_set_enabled(unsigned int enabled)
+{
+    krk_uring_enabled = enabled;
+}
+
+/**
+ * krk_uring_exit - tear the rings down
+ * @
+ *
+ * the workers must have been stopped and the connections
+ * destroyed.
+ */
+int krk_uring_exit(void)
+{
+    struct krk_event_loop *saved;
+    struct krk_uring *ring;
+    unsigned int i;
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        saved = krk_event_loop_switch(krk_event_loop_get(i));
+        ring = krk_uring_ring();
+
+        if (ring->cq_ev) {
+            krk_uring_submit(ring);
+
+            krk_event_destroy(ring->cq_ev);
+            krk_event_destroy(ring->flush_ev);
+            ring->cq_ev = ring->flush_ev = NULL;
+
+            krk_uring_unmap(ring);
+            close(ring->fd);
+        }
+
+        krk_event_loop_switch(saved);
+    }
+
+    return KRK_OK;
+}
+
+void krk_uring_show(void)
+{
+    struct krk_uring *ring;
+    unsigned int i;
+
+    fprintf(stderr,"io engine = %s\n", krk_uring_enabled ? "io_uring" : "libevent");
+
+    for (i = 0; i <= krk_event_loop_nr_workers(); i++) {
+        ring = &krk_urings[i];
+
+        if (ring->cq_ev == NULL) {
+            continue;
+        }
+
+        fprintf(stderr,"loop %u: io_uring ops in flight = %u, cancelled = %u, "
+                "busy = %lu\n", i, ring->nr_ops, ring->nr_cancelled, ring->nr_busy);
+        fprintf(stderr,"loop %u: io_uring enter = %lu, sqes = %lu, cqes = %lu, "
+                "sqes per enter = %lu\n", i, ring->nr_enter, ring->nr_sqes,
+                ring->nr_cqes, ring->nr_enter ? ring->nr_sqes / ring->nr_enter : 0);
+    }
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+int krk_uring_available(void)
+{
+    return 0;
+}
+
+int krk_uring_connect(struct krk_event *event,
+        const struct sockaddr *addr, socklen_t addrlen)
+{
+    return KRK_BUSY;
+}
+
+int krk_uring_send(struct krk_event *event, const void *buf, size_t len)
+{
+    return KRK_BUSY;
+}
+
+int krk_uring_recv(struct krk_event *event, void *buf, size_t len)
+{
+    return KRK_BUSY;
+}
+
+int krk_uring_close(int sock)
+{
+    return KRK_BUSY;
+}
+
+int krk_uring_cancel(struct krk_event *event, uring_done done)
+{
+    return KRK_OK;
+}
+
+void krk_uring_drain(void)
+{
+}
+
+void krk_uring_set_enabled(unsigned int enabled)
+{
+    if (enabled) {
+        krk_log(KRK_LOG_NOTICE, "built without io_uring, using libevent\n");
+    }
+
+    krk_uring_enabled = 0;
+}
+
+int krk_uring_exit(void)
+{
+    return KRK_OK;
+}
+
+void krk_uring_show(void)
+{
+    fprintf(stderr,"io engine = libevent\n");
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
@@ -15,15 +15,53 @@
 
 extern struct krk_checker icmp_checker;
 
+/* kinds of the loops' icmp sockets */
+#define KRK_ICMP_SOCKET_AUTO 0      /* dgram if the group may, raw otherwise */
+#define KRK_ICMP_SOCKET_RAW 1
+#define KRK_ICMP_SOCKET_DGRAM 2     /* unprivileged ping socket */
+
+#define KRK_ICMP_PING_GROUP_RANGE "/proc/sys/net/ipv4/ping_group_range"
+
+extern void krk_icmp_set_socket_type(unsigned int type);
+
 #define KRK_MAX_IP_LEN 60
 #define KRK_MAX_ICMP_LEN 76
 #define KRK_ICMP_DATA_LEN 20
 
+#define KRK_ICMP_HDR_LEN 8
+
+/* packets read from a loop's socket per wakeup */
+#define KRK_ICMP_READ_BATCH 64
+/* echo requests sent with one syscall */
+#define KRK_ICMP_SEND_BATCH 64
+
 struct icmp_checker_data {
     unsigned short id;
+    unsigned short sequence;    /* of the probe in flight */
+    unsigned int loop;          /* id of the loop probing the node */
+    unsigned int ipv6;          /* probed over the loop's icmpv6 socket */
+};
+
+/* first word of the payload of our echo requests, "KRKE" */
+#define KRK_ICMP_MAGIC 0x4b524b45
+
+/**
+ * an echo request carries the node's handle in the identifier
+ * (high half) and the sequence number (low half), the payload
+ * starts with the magic, the handle again and the probe's own 
+ * sequence, the rest is padding. a ping socket overwrites the
+ * identifier, the handle of the payload is used then.
+ */
+struct krk_icmp_payload {
+    unsigned int magic;
+    unsigned int handle;
     unsigned short sequence;
 };
 
+#define krk_icmp_handle(icp) \
+    (((unsigned int)ntohs((icp)->un.echo.id) << 16) \
+     | ntohs((icp)->un.echo.sequence))
+
 struct krk_icmphdr {
     unsigned char type;
     unsigned char code;
@@ -0,0 +1,59 @@
+/**
+ * krk_arena.h - Krake bump arena
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __KRK_ARENA_H__
+#define __KRK_ARENA_H__
+
+#include <krk_core.h>
+
+/* size of the chunk an arena keeps across resets */
+#define KRK_ARENA_CHUNK_SIZE 4096
+#define KRK_ARENA_ALIGN 16
+
+struct krk_arena_chunk {
+    struct krk_arena_chunk *next;
+    size_t size;
+    char data[];
+};
+
+/**
+ * bump allocator, memory is handed out by moving a pointer
+ * and only given back all at once by krk_arena_reset.
+ * the first chunk survives a reset, so a reused arena does
+ * not allocate again until it outgrows that chunk.
+ */
+struct krk_arena {
+    struct krk_arena_chunk *head;   /* the kept chunk */
+    struct krk_arena_chunk *extra;  /* overflow chunks, freed on reset */
+    char *pos;
+    char *end;
+
+    unsigned long nr_alloc;     /* allocations served since init */
+    unsigned long nr_overflow;  /* of them, served by an overflow chunk */
+};
+
+/* allocations after a mark are given back by krk_arena_rewind */
+struct krk_arena_mark {
+    struct krk_arena_chunk *extra;
+    char *pos;
+    char *end;
+};
+
+extern void krk_arena_init(struct krk_arena *arena);
+extern void* krk_arena_alloc(struct krk_arena *arena, size_t size);
+extern void* krk_arena_calloc(struct krk_arena *arena, size_t size);
+extern void krk_arena_mark(struct krk_arena *arena, struct krk_arena_mark *mark);
+extern void krk_arena_rewind(struct krk_arena *arena, struct krk_arena_mark *mark);
+extern void krk_arena_reset(struct krk_arena *arena);
+extern void krk_arena_destroy(struct krk_arena *arena);
+
+#endif
@@ -30,10 +30,24 @@
 #define KRK_CONF_MONITOR_LOG            0x200
 #define KRK_CONF_MONITOR_LOGTYPE        0x400
 #define KRK_CONF_MONITOR_LOGLEVEL       0x800
+#define KRK_CONF_MONITOR_JITTER         0x1000
+#define KRK_CONF_MONITOR_SUSPECT_INTERVAL 0x2000
+#define KRK_CONF_MONITOR_STABLE_INTERVAL  0x4000
+#define KRK_CONF_MONITOR_BACKOFF_MAX    0x8000
+#define KRK_CONF_MONITOR_PRIORITY       0x10000
 
 #define KRK_CONF_MONITOR_NODE_HOST      0x01
 #define KRK_CONF_MONITOR_NODE_PORT      0x02
 
+#define KRK_CONF_GLOBAL                 0x01
+#define KRK_CONF_GLOBAL_MAX_INFLIGHT    0x01
+#define KRK_CONF_GLOBAL_WORKERS         0x02
+#define KRK_CONF_GLOBAL_IO_ENGINE       0x04
+#define KRK_CONF_GLOBAL_LAG_THRESHOLD   0x08
+#define KRK_CONF_GLOBAL_MAX_MONITORS    0x10
+#define KRK_CONF_GLOBAL_MAX_NODES       0x20
+#define KRK_CONF_GLOBAL_ICMP_SOCKET     0x40
+
 #define KRK_CONF_TYPE_MONITOR 1
 #define KRK_CONF_TYPE_NODE 2
 #define KRK_CONF_TYPE_LOG 3
@@ -44,6 +58,15 @@
 #define KRK_CONF_DEFAULT_TIMEOUT 3
 #define KRK_CONF_DEFAULT_F_THRESHOLD 3
 #define KRK_CONF_DEFAULT_S_THRESHOLD 3
+#define KRK_CONF_DEFAULT_MAX_INFLIGHT 960
+#define KRK_CONF_DEFAULT_LAG_THRESHOLD 100000 /* in usec */
+#define KRK_CONF_DEFAULT_MAX_MONITORS 64
+#define KRK_CONF_DEFAULT_MAX_NODES 10000
+
+#define KRK_CONF_IO_ENGINE_LIBEVENT 0
+#define KRK_CONF_IO_ENGINE_URING 1
+#define KRK_CONF_DEFAULT_PRIORITY 3
+#define KRK_CONF_MAX_PRIORITY 7
 
 struct krk_config_node {
     struct krk_config_node *next;
@@ -63,10 +86,15 @@ struct krk_config_monitor {
     unsigned long checker_param_len;
     char script[KRK_NAME_LEN];
 
-    unsigned long interval;
-    unsigned long timeout;
+    unsigned long interval; /* in usec */
+    unsigned long timeout;  /* in usec */
+    unsigned long jitter;   /* in usec */
+    unsigned long suspect_interval; /* in usec */
+    unsigned long stable_interval;  /* in usec */
+    unsigned long backoff_max;      /* in usec */
     unsigned long failure_threshold;
     unsigned long success_threshold;
+    unsigned long priority;
 
     /* args of node */
     struct krk_config_node *node;
@@ -78,10 +106,22 @@ struct krk_config_log {
     char log_level[KRK_ARG_LEN];
 };
 
+struct krk_config_global {
+    unsigned int config;
+    unsigned long max_inflight; /* probes allowed in flight at once */
+    unsigned long workers;      /* worker threads, 0 runs all in the main one */
+    unsigned int io_engine;     /* KRK_CONF_IO_ENGINE_* */
+    unsigned long lag_threshold; /* loop lag to shed load at, in usec */
+    unsigned long max_monitors; /* monitors allowed to exist */
+    unsigned long max_nodes;    /* nodes allowed to exist, over all monitors */
+    unsigned int icmp_socket;   /* KRK_ICMP_SOCKET_* */
+};
+
 struct krk_config {
     unsigned int config;
     struct krk_config_monitor *monitor;
     struct krk_config_log log;
+    struct krk_config_global global;
 };
 
 enum {
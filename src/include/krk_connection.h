@@ -17,6 +17,10 @@
 #include <krk_list.h>
 
 #include <krk_ssl.h>
+#include <krk_arena.h>
+
+/* connections kept out of the probe budget, for control sockets */
+#define KRK_CONNECTION_RESERVED 64
 
 struct krk_connection;
 
@@ -36,18 +40,35 @@ struct krk_connection {
     send_handler send;
 
     struct krk_ssl_connection *ssl;
+
+    /* scratch memory of the probe, released when it is destroyed */
+    struct krk_arena arena;
     
     int sock;
 
     int ready:1;
+    unsigned int pooled:1;  /* recycled by krk_connection_destroy */
+    unsigned int uring:1;   /* io goes through io_uring, see krk_connection_connect */
+    unsigned int sending:1; /* io_uring send queued, its result not yet taken */
+    unsigned int nr_cancelled:2; /* ops the kernel holds after destroy */
 };
 
 extern struct krk_connection* krk_connection_create(const char *name, 
         size_t rbufsz, size_t wbufsz);
 extern int krk_connection_destroy(struct krk_connection *conn);
 extern int krk_connection_init(void);
+extern void krk_connection_set_max(unsigned int max);
 extern int krk_all_connections_destroy(void);
 extern int krk_connection_exit(void);
+extern void krk_connection_show(void);
+extern int krk_connection_connect(struct krk_connection *conn, 
+        const struct sockaddr *addr, socklen_t addrlen);
+extern int krk_connection_connect_error(struct krk_connection *conn);
+extern void krk_connection_wait_write(struct krk_connection *conn);
+extern void krk_connection_wait_read(struct krk_connection *conn, 
+        char *buf, size_t size);
+extern void krk_connection_read_more(struct krk_connection *conn, 
+        char *buf, size_t size);
 
 ssize_t 
 krk_connection_recv(struct krk_connection *conn, u_char *buf, size_t size);
@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
+#include <limits.h>
 
 #define PID_FILE "/var/run/krake.pid"
 
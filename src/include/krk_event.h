@@ -13,30 +13,147 @@
 #ifndef __KRK_EVENT_H__
 #define __KRK_EVENT_H__
 
+#include <pthread.h>
 #include <event2/event.h>
 
+/* libevent has its own LIST_HEAD, keep the one of krk_list.h out of its way */
+#pragma push_macro("LIST_HEAD")
+#undef LIST_HEAD
+#include <event2/event_struct.h>
+#pragma pop_macro("LIST_HEAD")
+
+#include <krk_list.h>
+
+/**
+ * timing wheel, all the timeouts of krk_events live here
+ * instead of in libevent's min-heap. 4 levels of 256 slots
+ * with a 1ms tick cover ~49 days.
+ */
+#define KRK_TIMER_TICK_USEC 1000
+#define KRK_TIMER_WHEEL_BITS 8
+#define KRK_TIMER_WHEEL_SIZE (1 << KRK_TIMER_WHEEL_BITS)
+#define KRK_TIMER_WHEEL_MASK (KRK_TIMER_WHEEL_SIZE - 1)
+#define KRK_TIMER_WHEEL_LEVELS 4
+
+struct krk_timer;
+
+typedef void (*timer_handler)(struct krk_timer *timer);
+
+struct krk_timer {
+    struct list_head list;
+    unsigned long expires;  /* in wheel ticks */
+    timer_handler handler;
+    void *data;
+
+    unsigned int level:4;
+    unsigned int pending:1;
+};
+
+struct krk_timer_wheel {
+    struct list_head slots[KRK_TIMER_WHEEL_LEVELS][KRK_TIMER_WHEEL_SIZE];
+    unsigned long nr_timers[KRK_TIMER_WHEEL_LEVELS];
+
+    unsigned long now;      /* last processed tick */
+    unsigned long next;     /* tick the backing timer is armed for */
+    struct event *ev;       /* the only libevent timer behind the wheel */
+
+    unsigned int armed:1;
+};
+
+/**
+ * loop 0 is the coordinator, it owns the control socket and 
+ * the configuration. the workers 1..n run the monitors, each
+ * with its own event_base and timing wheel.
+ */
+#define KRK_EVENT_LOOP_MAX_WORKERS 32
+#define KRK_EVENT_LOOP_MAX (KRK_EVENT_LOOP_MAX_WORKERS + 1)
+
+/* period of the lag watchdog of each loop, in usec */
+#define KRK_EVENT_LAG_INTERVAL 100000
+
+struct krk_event_loop {
+    unsigned int id;
+    struct event_base *base;
+    struct krk_timer_wheel wheel;
+
+    struct event *pause_ev; /* parks a worker for stop-the-world */
+    pthread_t thread;
+
+    /**
+     * lag watchdog: how late the wheel runs is how long ready
+     * events wait to be handled, in usec. lag_timer keeps an
+     * idle wheel running so the lag is always known.
+     */
+    struct krk_timer lag_timer;
+    unsigned long long lag_high_at; /* last sample over half the threshold */
+    unsigned long lag_last;
+    unsigned long lag_max;
+    unsigned long long lag_sum;
+    unsigned long nr_lag;
+    unsigned long nr_overload;  /* times the lag crossed the threshold */
+
+    unsigned int running:1;
+    unsigned int overloaded:1;  /* lag over the threshold, not yet recovered */
+};
+
+/* the loop the calling thread works on */
+extern __thread struct krk_event_loop *krk_current_loop;
+
 typedef void (*ev_handler)(int sock, short type, void *arg);
 
 struct krk_event {
-    struct event *ev;
+    struct event *ev;       /* points to io once assigned, NULL for timers */
+    struct event io;
     struct timeval *timeout;
     ev_handler handler;
     void *conn;
     struct krk_buffer *buf;
     void *data;
+
+    struct krk_timer timer;
+    struct timeval tv;      /* storage for timeout, see krk_event_set_timeout */
+    int sock;
+
+    int result;             /* of the last io_uring operation, see krk_uring.h */
+    unsigned int uring_op;  /* io_uring operation pending, 0 for none */
 };
 
 
 extern int krk_event_init(void);
 extern int krk_event_exit(void);
 extern void krk_event_loop(void);
+extern void krk_event_loop_break(void);
 extern int krk_event_add(struct krk_event *event);
+extern int krk_event_add_at(struct krk_event *event, unsigned long long usec);
 extern int krk_event_del(struct krk_event *event);
+extern void krk_event_active(struct krk_event *event, short type);
 extern struct krk_event* krk_event_create(size_t bufsz);
 extern int krk_event_destroy(struct krk_event* event);
 extern void krk_event_set(int sock, struct krk_event *event, short type);
 extern void krk_event_set_timer(struct krk_event *tmout);
+extern void krk_event_set_timeout(struct krk_event *event, unsigned long usec);
+extern void krk_event_reset(struct krk_event *event);
 extern void krk_event_set_read(int sock, struct krk_event *event);
 extern void krk_event_set_write(int sock, struct krk_event *event);
+extern void krk_event_set_persist_read(int sock, struct krk_event *event);
+
+extern int krk_event_loops_start(unsigned int nr_workers);
+extern void krk_event_loops_stop(void);
+extern void krk_event_loops_pause(void);
+extern void krk_event_loops_resume(void);
+extern unsigned int krk_event_loop_nr_workers(void);
+extern struct krk_event_loop* krk_event_loop_get(unsigned int id);
+extern struct krk_event_loop* krk_event_loop_pick(const char *key);
+extern struct krk_event_loop* krk_event_loop_switch(struct krk_event_loop *loop);
+extern void krk_event_set_lag_threshold(unsigned long usec);
+extern int krk_event_loop_overloaded(void);
+extern void krk_event_show(void);
+
+extern void krk_timer_init(struct krk_timer *timer, 
+        timer_handler handler, void *data);
+extern void krk_timer_add(struct krk_timer *timer, const struct timeval *tv);
+extern void krk_timer_add_at(struct krk_timer *timer, unsigned long long usec);
+extern void krk_timer_del(struct krk_timer *timer);
+extern unsigned long long krk_time_usec(void);
 
 #endif
@@ -0,0 +1,56 @@
+/**
+ * krk_hash.h - Krake hash index
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __KRK_HASH_H__
+#define __KRK_HASH_H__
+
+#include <krk_core.h>
+#include <krk_list.h>
+
+#define KRK_HASH_MIN_SIZE 16
+
+/**
+ * chained hash table of objects embedding a krk_hash_link.
+ * the table only knows the hash value of an object, callers
+ * walk a bucket with krk_hash_for_each and compare keys
+ * themselves. it doubles when it gets twice as full as it
+ * is wide.
+ */
+struct krk_hash_link {
+    struct list_head list;
+    unsigned int hash;
+};
+
+struct krk_hash {
+    struct list_head *buckets;
+    unsigned long size;     /* power of 2 */
+    unsigned long nr;
+};
+
+#define krk_hash_bucket(table, h) (&(table)->buckets[(h) & ((table)->size - 1)])
+
+/* walk the objects which may have hash value h, pos is a krk_hash_link */
+#define krk_hash_for_each(pos, table, h) \
+    for (pos = list_entry(krk_hash_bucket(table, h)->next, struct krk_hash_link, list); \
+            &pos->list != krk_hash_bucket(table, h); \
+            pos = list_entry(pos->list.next, struct krk_hash_link, list))
+
+extern int krk_hash_init(struct krk_hash *table, unsigned long size);
+extern void krk_hash_destroy(struct krk_hash *table);
+extern void krk_hash_add(struct krk_hash *table, 
+        struct krk_hash_link *link, unsigned int hash);
+extern void krk_hash_del(struct krk_hash *table, struct krk_hash_link *link);
+extern unsigned int krk_hash_fnv(const void *data, size_t len, unsigned int hash);
+
+#define KRK_HASH_FNV_INIT 2166136261U
+
+#endif
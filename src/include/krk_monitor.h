@@ -25,23 +25,61 @@
 #include <krk_config.h>
 #include <krk_connection.h>
 #include <krk_ssl.h>
+#include <krk_hash.h>
 #include <checkers/krk_checker.h>
 
 #define KRK_MONITOR_FLAG_ENABLED 0x1
 
-#define KRK_MONITOR_MAX_NR 64
-#define KRK_NODE_MAX_NUM 10000
+/* node handles, index of the node's slot in the low bits, generation above */
+#define KRK_NODE_HANDLE_BITS 24
+#define KRK_NODE_HANDLE_MASK ((1U << KRK_NODE_HANDLE_BITS) - 1)
+#define KRK_NODE_HANDLE_GEN_MASK 0xff
+#define krk_node_handle(index, gen) (((gen) << KRK_NODE_HANDLE_BITS) | (index))
+/* hard limit of <max_nodes>, the last index ends the free list */
+#define KRK_NODE_MAX_NUM KRK_NODE_HANDLE_MASK
+/* slots the handle table starts with, it doubles when full */
+#define KRK_NODE_TABLE_MIN_SIZE 1024
+/* node states per chunk of the state array, chunks never move */
+#define KRK_NODE_STATE_CHUNK_BITS 12
+#define KRK_NODE_STATE_CHUNK (1U << KRK_NODE_STATE_CHUNK_BITS)
+#define KRK_NODE_STATE_NR_CHUNKS ((KRK_NODE_MAX_NUM >> KRK_NODE_STATE_CHUNK_BITS) + 1)
+/* the verdict part of a node state sits on a line of its own */
+#define KRK_NODE_STATE_CACHELINE 64
+
+/* deficit a waiting monitor earns per dispatch round, in probes */
+#define KRK_MONITOR_DRR_QUANTUM 1
+/* retry delay when a dispatched probe found no free connection, in usec */
+#define KRK_MONITOR_DISPATCH_RETRY 10000
+/* priority classes, a bigger number is served first */
+#define KRK_MONITOR_PRIO_NR (KRK_CONF_MAX_PRIORITY + 1)
+/* interval factor of classes shed under overload */
+#define KRK_MONITOR_STRETCH 2
+/* classes up to this one are stretched while their loop lags */
+#define KRK_MONITOR_LAG_PRIO KRK_CONF_DEFAULT_PRIORITY
+/* entries of a loop's result/verdict ring */
+#define KRK_MONITOR_RESULT_RING 8192
+/* entries drained per run of the ring handler */
+#define KRK_MONITOR_RESULT_BATCH 64
 
 struct krk_monitor {
     char name[KRK_NAME_LEN];
-    unsigned char id;
+    unsigned int id;
 
     struct list_head list;
+    struct krk_hash_link hash;      /* link in the index by name */
+
+    /* the event loop probing the nodes, fixed for the monitor's life */
+    struct krk_event_loop *loop;
 
-    unsigned long interval;
-    unsigned long timeout;
+    unsigned long interval; /* in usec */
+    unsigned long timeout;  /* in usec */
+    unsigned long jitter;   /* window the node probes are spread over, in usec */
+    unsigned long suspect_interval; /* nodes about to change state, in usec */
+    unsigned long stable_interval;  /* stable up nodes relax to this, in usec */
+    unsigned long backoff_max;      /* cap of the down node backoff, in usec */
     unsigned long failure_threshold;
     unsigned long success_threshold;
+    unsigned int priority;
 
     struct krk_checker *checker;
     void *checker_param;
@@ -50,8 +88,23 @@ struct krk_monitor {
 
     struct list_head node_list;
     unsigned long nr_nodes;
+    struct krk_hash node_index;     /* nodes by address and port */
 
-    struct krk_event *tmout_ev;	
+    struct list_head pending_list;  /* nodes waiting for an in-flight slot */
+    struct list_head pending;       /* link in the dispatch round */
+    unsigned long nr_pending;
+    unsigned long deficit;
+    unsigned long nr_deferred;      /* probes which had to wait */
+    unsigned long nr_shed;          /* probes dropped for higher classes */
+    unsigned long nr_stretched;     /* intervals stretched for loop lag */
+    unsigned long nr_late;          /* timeouts not counted for loop lag */
+
+    /* scheduling lag, actual minus planned probe start, in usec */
+    unsigned long lag_last;
+    unsigned long lag_max;
+    unsigned long long lag_sum;
+    unsigned long nr_lag;
+    unsigned long nr_missed;        /* cycles skipped by late nodes */
 
     char notify_script[KRK_NAME_LEN];
     char notify_script_name[KRK_NAME_LEN];
@@ -60,21 +113,85 @@ struct krk_monitor {
 
     unsigned int enabled:1;
     unsigned int ssl_flag:1;
+    unsigned int marked:1;  /* still in the config, see krk_remove_unused_monitor */
+};
+
+/**
+ * outcome of one probe. workers pass results to loop 0, which
+ * owns the node state, and get back a verdict carrying the new
+ * state to adapt the probe interval to.
+ */
+struct krk_monitor_result {
+    struct krk_monitor *monitor;
+    struct krk_node *node;
+
+    unsigned int success:1;
+    unsigned int down:1;    /* verdicts only */
+    unsigned int suspect:1; /* verdicts only */
 };
 
 struct krk_monitor_info {
     char name[KRK_NAME_LEN];
     char checker[KRK_NAME_LEN];
     unsigned long nr_nodes;
+    unsigned long nr_pending;
+    unsigned long nr_deferred;
+    unsigned long nr_shed;
+    unsigned long nr_stretched;
+    unsigned long nr_late;
+    unsigned int priority;
+    unsigned long lag_last;
+    unsigned long lag_avg;
+    unsigned long lag_max;
+    unsigned long nr_missed;
     unsigned int enabled:1;
 };
 
+/**
+ * node key: the binary address and the port, what tells
+ * two nodes of a monitor apart.
+ */
+struct krk_node_key {
+    unsigned char addr[16];
+    unsigned short port;
+    unsigned short ipv6;
+};
+
+/**
+ * hot state of a node, what the scheduler and the verdicts
+ * touch on each probe. the states live in a dense array indexed
+ * by the node handle, apart from the rest of struct krk_node, 
+ * so a scan over them does not pull the text address, the 
+ * lists and the checker data through the cache.
+ *
+ * the loop of the monitor owns the schedule and ready, loop 0
+ * owns the verdict. the two parts never share a cache line,
+ * nor a word, they are written by different threads.
+ */
+struct krk_node_state {
+    /* the monitor's loop */
+    unsigned long long deadline; /* next planned probe start, monotonic usec */
+    unsigned long long planned;  /* planned start of the probe due now */
+    unsigned long offset;       /* phase offset inside the jitter window, in usec */
+    unsigned long cur_interval; /* adaptive probe interval, in usec */
+    unsigned long backoff;      /* backoff of a down node, in usec, 0 for none */
+
+    struct krk_node_key key;
+
+    unsigned char used;         /* the slot holds a node */
+    unsigned char ready;        /* set by the checker's init_node */
+
+    /* loop 0 */
+    unsigned int nr_fail __attribute__((aligned(KRK_NODE_STATE_CACHELINE)));
+    unsigned int nr_success;
+    unsigned char down;
+};
+
 struct krk_node {
     char addr[KRK_IPADDR_LEN];
     unsigned int port;
-    unsigned int nr_fail;
-    unsigned int nr_success;
-    unsigned char id;
+    unsigned int id;            /* handle, unique over the daemon */
+    struct krk_node_state *state;   /* hot state, indexed by id */
 
     union {
         struct sockaddr_in inaddr;
@@ -83,6 +200,10 @@ struct krk_node {
 
     struct list_head list;
     struct krk_monitor *parent;
+    struct krk_hash_link hash;      /* link in parent->node_index */
+
+    struct krk_event *tmout_ev; /* per-node probe timer */
+    struct list_head pending;   /* link in monitor->pending_list */
 
     struct krk_connection *conn;
     struct list_head connection_list;
@@ -92,9 +213,7 @@ struct krk_node {
 
     struct krk_buffer *buf;
 
-    unsigned int ipv6:1;
-    unsigned int down:1;
-    unsigned int ready:1;
+    unsigned int marked:1;  /* still in the config, see krk_remove_unused_node */
 };
 
 struct krk_node_info {
@@ -102,6 +221,8 @@ struct krk_node_info {
     unsigned int port;
     unsigned int nr_fail;
     unsigned int nr_success;
+    unsigned long cur_interval;
+    unsigned long backoff;
     unsigned int ipv6:1;
     unsigned int down:1;
     unsigned int ready:1;
@@ -133,14 +254,13 @@ extern void krk_monitor_notify(struct krk_monitor *monitor,
         struct krk_node *node);
 extern int krk_monitor_add_node_connection(struct krk_node *node, struct krk_connection *conn);
 extern int krk_monitor_remove_node_connection(struct krk_node *node, struct krk_connection *conn);
-extern int krk_monitor_get_nodes_by_addr(const char *addr, 
-        struct krk_node *nodes);
 extern int krk_monitor_get_all_nodes(struct krk_monitor *monitor, 
         struct krk_node *nodes);
-extern struct krk_node* krk_monitor_find_node_by_id(const unsigned char id, 
+extern struct krk_node* krk_monitor_find_node_by_handle(unsigned int handle);
+extern struct krk_node* krk_monitor_find_node_by_id(const unsigned int id, 
         struct krk_monitor *monitor);
 extern int krk_monitor_set_node_status(struct krk_monitor *monitor, 
-        unsigned char id, int status);
+        unsigned int id, int status);
 extern void krk_monitor_show(void);
 extern int krk_monitor_get_all_monitors(struct krk_monitor *monitors);
 extern int krk_get_all_monitor_name(char *buf);
@@ -149,10 +269,15 @@ extern int krk_monitor_destroy_all_nodes(struct krk_monitor *monitor);
 extern void krk_get_monitor_info(struct krk_monitor_info *info, struct krk_monitor *monitor);
 extern void krk_show_monitor_info(struct krk_monitor_info *info);
 extern void krk_show_node_info(struct krk_node_info *info);
-extern size_t krk_info_buffer_size(void);
+extern size_t krk_info_buffer_size(struct krk_monitor *monitor);
 extern int krk_monitor_init_node_ssl(struct krk_node *node);
 
 extern void krk_monitor_node_failure_inc(struct krk_monitor *, struct krk_node *);
 extern void krk_monitor_node_success_inc(struct krk_monitor *, struct krk_node *);
+extern void krk_monitor_node_timeout_inc(struct krk_monitor *, struct krk_node *);
+extern void krk_monitor_set_max_inflight(unsigned int max);
+extern void krk_monitor_set_limits(unsigned long max_monitors, 
+        unsigned long max_nodes);
+extern void krk_monitor_results_flush(void);
 
 #endif
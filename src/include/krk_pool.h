@@ -0,0 +1,56 @@
+/**
+ * krk_pool.h - Krake object pool
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __KRK_POOL_H__
+#define __KRK_POOL_H__
+
+#include <krk_core.h>
+#include <krk_list.h>
+#include <krk_event.h>
+
+/* how often the free list is trimmed to the recent peak, in sec */
+#define KRK_POOL_TRIM_INTERVAL 60
+
+typedef struct list_head* (*pool_alloc)(void);
+typedef void (*pool_release)(struct list_head *item);
+
+/**
+ * free list of fully initialised objects, an object is
+ * linked in by a list_head embedded in it.
+ */
+struct krk_pool {
+    char name[KRK_NAME_LEN];
+
+    struct list_head free_list;
+    unsigned long nr_free;
+    unsigned long nr_used;
+    unsigned long high_water;   /* peak of nr_used since the last trim */
+
+    unsigned long nr_hit;       /* gets served from the free list */
+    unsigned long nr_miss;      /* gets which had to allocate */
+    unsigned long nr_trimmed;   /* objects released by trimming */
+
+    pool_alloc alloc;
+    pool_release release;
+
+    struct krk_timer trim_timer;
+};
+
+extern void krk_pool_init(struct krk_pool *pool, const char *name,
+        pool_alloc alloc, pool_release release);
+extern struct list_head* krk_pool_get(struct krk_pool *pool);
+extern void krk_pool_put(struct krk_pool *pool, struct list_head *item);
+extern void krk_pool_trim(struct krk_pool *pool);
+extern void krk_pool_destroy(struct krk_pool *pool);
+extern void krk_pool_show(struct krk_pool *pool);
+
+#endif
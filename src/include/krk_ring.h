@@ -0,0 +1,52 @@
+/**
+ * krk_ring.h - Krake lock-free MPSC ring
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __KRK_RING_H__
+#define __KRK_RING_H__
+
+#include <krk_core.h>
+
+#define KRK_RING_CACHELINE 64
+
+/**
+ * bounded queue of fixed size entries, any thread may push,
+ * a single thread pops. every slot carries a sequence number
+ * telling whose turn it is, so producers only race on the
+ * tail with one compare-and-swap and never wait for each other.
+ */
+struct krk_ring_slot {
+    unsigned long seq;
+    char data[];
+};
+
+struct krk_ring {
+    /* written by producers */
+    unsigned long tail __attribute__((aligned(KRK_RING_CACHELINE)));
+    unsigned long nr_full;      /* pushes refused, ring was full */
+
+    /* written by the consumer */
+    unsigned long head __attribute__((aligned(KRK_RING_CACHELINE)));
+    unsigned long nr_pop;
+
+    unsigned long mask __attribute__((aligned(KRK_RING_CACHELINE)));
+    size_t entry_size;
+    size_t slot_size;
+    char *slots;
+};
+
+extern struct krk_ring* krk_ring_create(unsigned int size, size_t entry_size);
+extern void krk_ring_destroy(struct krk_ring *ring);
+extern int krk_ring_push(struct krk_ring *ring, const void *entry);
+extern int krk_ring_pop(struct krk_ring *ring, void *entry);
+extern unsigned long krk_ring_count(struct krk_ring *ring);
+
+#endif
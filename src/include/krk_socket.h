@@ -21,12 +21,17 @@ struct krk_node;
 
 #define LOCAL_SOCK_PATH "/var/run/krake.sock"
 #define LOCAL_SOCK_BACKLOG 5
+/* initial write buffer of a local connection, grown to the reply */
+#define LOCAL_SOCK_BUFSZ 4096
 
 extern int krk_local_socket_init(void);
 extern int krk_local_socket_exit(void);
 
 extern int krk_socket_tcp_create(int protocol);
 extern int krk_socket_raw_create(int protocol);
+extern int krk_socket_dgram_create(int protocol);
+extern int krk_socket_raw6_create(int protocol);
+extern int krk_socket_dgram6_create(int protocol);
 extern int krk_socket_close(int sock);
 
 extern int krk_socket_tcp_connect(int sock, struct krk_node *node);
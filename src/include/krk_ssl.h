@@ -22,6 +22,8 @@
 
 typedef SSL krk_ssl_socket;
 
+struct krk_arena;
+
 struct krk_ssl {
     SSL_CTX *ctx;
 };
@@ -39,7 +41,8 @@ extern struct krk_ssl* krk_ssl_new_ctx(void);
 extern int krk_ssl_init_ctx(struct krk_ssl *ssl);
 
 extern struct krk_ssl_connection * 
-krk_ssl_create_connection(int sock, struct krk_ssl *ssl);
+krk_ssl_create_connection(int sock, struct krk_ssl *ssl, 
+        struct krk_arena *arena);
 
 ssize_t 
 krk_ssl_recv(krk_ssl_socket *ssl, u_char *buf, size_t size);
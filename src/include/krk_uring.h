@@ -0,0 +1,45 @@
+/**
+ * krk_uring.h - Krake io_uring engine
+ *
+ * Copyright (c) 2010 Yang Yang <paulyang.inf@gmail.com>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __KRK_URING_H__
+#define __KRK_URING_H__
+
+#include <krk_core.h>
+#include <krk_event.h>
+
+/* submission queue size of each loop's ring, also the op limit */
+#define KRK_URING_ENTRIES 256
+
+/* the kernel is done with the cancelled operation of the event */
+typedef void (*uring_done)(struct krk_event *event);
+
+/**
+ * an io_uring operation completes by calling the event's
+ * handler, as if libevent had reported the io ready:
+ * EV_WRITE for connect and send, EV_READ for recv. the 
+ * result of the operation is left in event->result.
+ */
+extern int krk_uring_available(void);
+extern void krk_uring_set_enabled(unsigned int enabled);
+extern int krk_uring_connect(struct krk_event *event,
+        const struct sockaddr *addr, socklen_t addrlen);
+extern int krk_uring_send(struct krk_event *event,
+        const void *buf, size_t len);
+extern int krk_uring_recv(struct krk_event *event,
+        void *buf, size_t len);
+extern int krk_uring_close(int sock);
+extern int krk_uring_cancel(struct krk_event *event, uring_done done);
+extern void krk_uring_drain(void);
+extern int krk_uring_exit(void);
+extern void krk_uring_show(void);
+
+#endif